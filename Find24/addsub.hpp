@@ -44,6 +44,14 @@ public:
         rank_ = calcRank(ExprType::ADDSUB, add_list_, sub_list_);
     }
     
+    // straight from the member lists of another AddSub (see checkpoint.hpp),
+    // which are in cmpExpr() order already
+    AddSub(const ExprList& add_list, const ExprList& sub_list) :
+    add_list_(add_list), sub_list_(sub_list)
+    {
+        rank_ = calcRank(ExprType::ADDSUB, add_list_, sub_list_);
+    }
+    
     int cmp(const Expr& other) const {
         const AddSub* expr=dynamic_cast<const AddSub*>(&other);
         int ret=compareExprList(add_list_, expr->add_list_);
@@ -51,32 +59,32 @@ public:
         return compareExprList(sub_list_, expr->sub_list_);
     }
     
-    std::string toString(bool embed) const {
+    void write(ExprWriter& out, bool embed) const {
         auto it=add_list_.cbegin();
         assert(it != add_list_.cend());
-        std::string ret;
-        if (embed) ret+="(";
-        ret+=(*it)->toString(true);
+        if (embed) out.put('(');
+        (*it)->write(out, true);
         
         while (++it != add_list_.cend()) {
-            ret+="+";
-            ret+=(*it)->toString(true);
+            out.put('+');
+            (*it)->write(out, true);
         }
         
         for (auto& expr : sub_list_) {
-            ret+="-";
-            ret+=expr->toString(true);
+            out.put('-');
+            expr->write(out, true);
         }
         
-        if (embed) ret+=")";
-        
-        return ret;
+        if (embed) out.put(')');
     }
     
     ExprType getType() const { return ExprType::ADDSUB; }
     
     Rank getRank() const { return rank_; }
     
+    const ExprList& getAddList() const { return add_list_; }
+    const ExprList& getSubList() const { return sub_list_; }
+    
     virtual ~AddSub() {
         // all Expr* stored in the two lists are all borrowed references
         // hence no need to free.
@@ -0,0 +1,234 @@
+//
+//  beam24.cpp
+//  Find24
+//
+
+#include "beam24.hpp"
+#include "literal.hpp"
+#include "opset.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <unordered_set>
+
+// Operands stay below this, so that Rational never overflows int64_t.
+static const int64_t VALUE_CAP=(1LL<<31)-1;
+
+// order-independent hash of the values of a state
+static uint64_t hashValue(const Rational& value) {
+    uint64_t h=(uint64_t)value.dividend()*0x9E3779B97F4A7C15ULL ^
+    (uint64_t)value.divisor()*0xC2B2AE3D27D4EB4FULL;
+    h^=h >> 29;
+    return h*0xBF58476D1CE4E5B9ULL;
+}
+
+bool Beam24::run(bool debug) {
+    const Clock::time_point deadline=Clock::now()+timeout_;
+    std::mt19937_64 rng(seed_);
+
+    limits_=limits_.effective();
+    if (limits_.max_dividend == 0 || limits_.max_dividend > VALUE_CAP) {
+        limits_.max_dividend=VALUE_CAP;
+    }
+    if (limits_.max_divisor == 0 || limits_.max_divisor > VALUE_CAP) {
+        limits_.max_divisor=VALUE_CAP;
+    }
+    root_limits_=limits_.atRoot(target_);
+
+    // the first pass is a plain beam search, the others add more and more
+    // noise to the scores to get out of its rut
+    for (restarts_=0; ; ++restarts_) {
+        double noise=(restarts_ == 0) ? 0 : 0.1*(1+restarts_%10);
+        if (search(rng, noise, deadline) || Clock::now() >= deadline) break;
+    }
+
+    if (debug) {
+        std::cout << "restarts=" << restarts_ << std::endl;
+        if (best_) {
+            std::cout << "closest=" << best_value_.toString() << std::endl;
+        }
+        std::cout << std::endl;
+    }
+
+    return isExact();
+}
+
+double Beam24::distance(const Rational& value) const {
+    double diff=(double)value.dividend()/(double)value.divisor()-target_;
+    return (diff < 0) ? -diff : diff;
+}
+
+// returns true if an exact solution was found
+bool Beam24::search(std::mt19937_64& rng, double noise,
+                    Clock::time_point deadline)
+{
+    nodes_.clear();
+    State start;
+    for (auto elem : elems_) {
+        start.push_back((int)nodes_.size());
+        nodes_.push_back({Rational(elem), nullptr, -1, -1});
+    }
+    if (start.size() == 1) {
+        keep(nodes_[0]);
+        return isExact();
+    }
+
+    std::vector<State> beam={start};
+    std::vector<Candidate> candidates;
+    while (!beam.empty() && beam[0].size() > 1) {
+        if (Clock::now() >= deadline) return false;
+        expand(beam, rng, noise, candidates);
+        if (candidates.empty()) return false;
+
+        if (beam[0].size() == 2) { // every candidate is a full expression
+            auto best=std::min_element(candidates.begin(), candidates.end(),
+                [this](const Candidate& a, const Candidate& b) {
+                    return distance(a.value) < distance(b.value);
+                });
+            keep({best->value, best->make, best->left, best->right});
+            return isExact();
+        }
+
+        // the best width_ states, skipping those with the same values
+        size_t head=std::min(candidates.size(), (size_t)width_*4);
+        std::partial_sort(candidates.begin(), candidates.begin()+head,
+                          candidates.end(),
+                          [](const Candidate& a, const Candidate& b) {
+                              return a.score < b.score;
+                          });
+        std::vector<State> next;
+        std::unordered_set<uint64_t> seen;
+        for (size_t c=0; c<head && next.size()<(size_t)width_; ++c) {
+            const Candidate& cand=candidates[c];
+            const State& parent=beam[cand.parent];
+            uint64_t h=hashValue(cand.value);
+            for (auto node : parent) {
+                if (node != cand.left && node != cand.right) {
+                    h+=hashValue(nodes_[node].value);
+                }
+            }
+            if (!seen.insert(h).second) continue;
+
+            State state;
+            for (auto node : parent) {
+                if (node != cand.left && node != cand.right) {
+                    state.push_back(node);
+                }
+            }
+            state.push_back((int)nodes_.size());
+            nodes_.push_back({cand.value, cand.make, cand.left, cand.right});
+            next.push_back(state);
+        }
+        beam.swap(next);
+    }
+    return false;
+}
+
+// One pair of values of a state, combined with each operator of the set.
+// The policies work as in Find24: a commutative operator is applied once,
+// the others in both orders unless both values are the same.
+struct Beam24::Pair {
+    const Beam24& beam;
+    const SearchLimits& limits;
+    int parent;
+    int a;
+    int b;
+    double rest; // the distance of the closest value left, -1 for none
+    std::uniform_real_distribution<double>& jitter;
+    std::mt19937_64& rng;
+    double noise;
+    std::vector<Candidate>& candidates;
+
+    template<typename Operator>
+    void apply() {
+        const Rational& x=beam.nodes_[a].value;
+        const Rational& y=beam.nodes_[b].value;
+        Rational result(0);
+        if (Operator::apply(x, y, limits, result)) {
+            add(&Operator::make, a, b, result);
+        }
+        if (Operator::commutative || x == y) return;
+        if (Operator::apply(y, x, limits, result)) {
+            add(&Operator::make, b, a, result);
+        }
+    }
+
+    void add(MakeFn make, int left, int right, const Rational& value) {
+        if (!limits.admits(value)) return;
+        double score=beam.distance(value);
+        if (rest >= 0 && rest < score) score=rest;
+        if (noise > 0) score+=jitter(rng);
+        candidates.push_back({score, parent, left, right, make, value});
+    }
+};
+
+// Every pair of values in every state, with every operator the limits
+// allow. A candidate scores by how close its closest value is to the target.
+void Beam24::expand(const std::vector<State>& beam, std::mt19937_64& rng,
+                    double noise, std::vector<Candidate>& candidates)
+{
+    std::uniform_real_distribution<double> jitter(0, noise*std::max(1, target_));
+    candidates.clear();
+    for (int p=0; p<(int)beam.size(); ++p) {
+        const State& state=beam[p];
+        const int n=(int)state.size();
+
+        // the three closest values, so that the closest one not taken by a
+        // pair is always among them
+        int closest[3]={-1, -1, -1};
+        for (int k=0; k<n; ++k) {
+            double d=distance(nodes_[state[k]].value);
+            for (int c=0; c<3; ++c) {
+                if (closest[c] < 0 ||
+                    d < distance(nodes_[state[closest[c]]].value)) {
+                    for (int m=2; m>c; --m) closest[m]=closest[m-1];
+                    closest[c]=k;
+                    break;
+                }
+            }
+        }
+
+        for (int i=0; i<n; ++i) {
+            for (int j=i+1; j<n; ++j) {
+                double rest=-1;
+                for (auto c : closest) {
+                    if (c >= 0 && c != i && c != j) {
+                        rest=distance(nodes_[state[c]].value);
+                        break;
+                    }
+                }
+
+                // the last pair makes the whole expression
+                const SearchLimits& limits=(n == 2) ? root_limits_ : limits_;
+                Pair pair={*this, limits, p, state[i], state[j], rest, jitter,
+                    rng, noise, candidates};
+                AnyOpSet::each(pair, limits_.ops);
+            }
+        }
+    }
+}
+
+void Beam24::keep(Node node) {
+    double dist=distance(node.value);
+    if (best_ && dist >= best_dist_) return;
+    exprs_.clear();
+    int index=(int)nodes_.size();
+    nodes_.push_back(node);
+    best_=buildExpr(index);
+    best_value_=node.value;
+    best_dist_=dist;
+}
+
+const Expr* Beam24::buildExpr(int index) {
+    const Node& node=nodes_[index];
+    Expr* expr;
+    if (!node.make) {
+        expr=new Literal((int)node.value.dividend());
+    } else {
+        const Expr* left=buildExpr(node.left);
+        const Expr* right=buildExpr(node.right);
+        expr=node.make(left, right);
+    }
+    exprs_.emplace_back(expr);
+    return expr;
+}
@@ -0,0 +1,109 @@
+//
+//  beam24.hpp
+//  Find24
+//
+
+#ifndef beam24_hpp
+#define beam24_hpp
+
+#include <vector>
+#include <memory>
+#include <random>
+#include <chrono>
+
+#include "rational.hpp"
+#include "expr.hpp"
+#include "searchlimits.hpp"
+
+// Heuristic search for inputs too large for Find24 (10 to 20 numbers).
+// A state is the multiset of values left after some combinations, and each
+// step combines a pair of them with one of the operators. Only the beamWidth
+// most promising states (closest to the target, with some random noise)
+// survive each step. It restarts with a fresh noise pattern until it finds
+// an exact solution or runs out of time, and keeps the closest expression
+// using all the numbers. The operators are the policies of opset.hpp, so
+// the expression prints the same way as Find24's solutions.
+class Beam24 {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    Beam24(int target, const std::vector<int>& elems) :
+    target_(target), elems_(elems), width_(64), seed_(1),
+    timeout_(std::chrono::seconds(1)), restarts_(0), best_(nullptr),
+    best_value_(0), best_dist_(-1) { }
+
+    void setBeamWidth(int width) { width_ = width; }
+
+    // the same seed and the same number of restarts give the same result
+    void setSeed(uint64_t seed) { seed_ = seed; }
+
+    // run() keeps restarting until an exact solution is found or the time
+    // is up
+    void setTimeout(Clock::duration timeout) { timeout_ = timeout; }
+
+    // only intermediate results within limits are used, as in Find24
+    void setLimits(const SearchLimits& limits) { limits_ = limits; }
+
+    // returns true if the best expression equals the target
+    bool run(bool debug);
+
+    // the closest expression found, nullptr if every attempt failed (e.g.
+    // the limits rule out all of them)
+    const Expr* getExpr() const { return best_; }
+
+    Rational getValue() const { return best_value_; }
+
+    bool isExact() const { return best_ && best_value_ == Rational(target_); }
+
+    int getTarget() const { return target_; }
+
+private:
+    // Operator::make() of the operator that built a value
+    typedef Expr* (*MakeFn)(const Expr* left, const Expr* right);
+
+    // how a value was built, indices refer to nodes_
+    struct Node {
+        Rational value;
+        MakeFn make; // nullptr for a literal
+        int left;
+        int right;
+    };
+
+    // one unfinished combination: the values left, as node indices
+    typedef std::vector<int> State;
+
+    // a State one step further, not materialized until it is kept
+    struct Candidate {
+        double score;
+        int parent;
+        int left;
+        int right;
+        MakeFn make;
+        Rational value;
+    };
+
+    struct Pair;
+
+    int target_;
+    std::vector<int> elems_;
+    int width_;
+    uint64_t seed_;
+    Clock::duration timeout_;
+    SearchLimits limits_;
+    SearchLimits root_limits_; // see SearchLimits::atRoot()
+    int restarts_;
+    std::vector<Node> nodes_;
+    std::vector<std::unique_ptr<Expr>> exprs_;
+    const Expr* best_;
+    Rational best_value_;
+    double best_dist_;
+
+    double distance(const Rational& value) const;
+    bool search(std::mt19937_64& rng, double noise, Clock::time_point deadline);
+    void expand(const std::vector<State>& beam, std::mt19937_64& rng,
+                double noise, std::vector<Candidate>& candidates);
+    void keep(Node node);
+    const Expr* buildExpr(int node);
+};
+
+#endif /* beam24_hpp */
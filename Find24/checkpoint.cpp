@@ -0,0 +1,341 @@
+//
+//  checkpoint.cpp
+//  Find24
+//
+
+#include "checkpoint.hpp"
+#include "literal.hpp"
+#include "addsub.hpp"
+#include "muldiv.hpp"
+#include "power.hpp"
+
+#include <cstring>
+#include <stdio.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the usual reflected CRC-32 (as in zlib), a byte at a time
+uint32_t crc32(const void* data, size_t size, uint32_t crc) {
+    struct Table {
+        uint32_t entries[256];
+        Table() {
+            for (uint32_t i=0; i<256; ++i) {
+                uint32_t c=i;
+                for (int k=0; k<8; ++k) {
+                    c=(c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+                }
+                entries[i]=c;
+            }
+        }
+    };
+    static const Table table;
+
+    const unsigned char* p=static_cast<const unsigned char*>(data);
+    crc=~crc;
+    for (size_t i=0; i<size; ++i) {
+        crc=table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t headerCrc(const CheckpointHeader& header, const int32_t* elems)
+{
+    uint32_t crc=crc32(&header, offsetof(CheckpointHeader, header_crc));
+    return crc32(elems, header.elem_count*sizeof(int32_t), crc);
+}
+
+CheckpointWriter::CheckpointWriter(const CheckpointHeader& header,
+                                   const std::vector<int>& elems) :
+section_(0), count_(0)
+{
+    CheckpointHeader h=header;
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.version=CHECKPOINT_VERSION;
+    h.length=0;
+    h.elem_count=(uint32_t)elems.size();
+    h.header_crc=0;
+    put(h);
+    for (int elem : elems) put((int32_t)elem);
+}
+
+void CheckpointWriter::putBytes(const void* data, size_t size) {
+    const size_t at=buf_.size();
+    buf_.resize(at+size);
+    memcpy(&buf_[at], data, size);
+}
+
+void CheckpointWriter::reserve(size_t exprs) {
+    growIndex(exprs);
+    // a record and a few members each
+    buf_.reserve(buf_.size()+
+                 exprs*(sizeof(CheckpointExpr)+4*sizeof(uint32_t)));
+}
+
+void CheckpointWriter::beginSection(CheckpointTag tag) {
+    endSection();
+    section_=buf_.size();
+    CheckpointSection section={(uint32_t)tag, 0, 0};
+    put(section);
+}
+
+void CheckpointWriter::endSection() {
+    if (!section_) return;
+    CheckpointSection section;
+    memcpy(&section, &buf_[section_], sizeof(section));
+    const size_t content=section_+sizeof(section);
+    section.length=buf_.size()-content;
+    section.crc=crc32(buf_.data()+content, section.length);
+    memcpy(&buf_[section_], &section, sizeof(section));
+    section_=0;
+}
+
+bool CheckpointWriter::putExpr(const Expr* expr) {
+    CheckpointExpr rec={(uint32_t)expr->getType(), 0, 0, 0};
+    const ExprList* pos=nullptr;
+    const ExprList* neg=nullptr;
+    const Expr* operands[2]={nullptr, nullptr};
+    switch (expr->getType()) {
+        case ExprType::LITERAL:
+            rec.value=static_cast<const Literal*>(expr)->getValue();
+            break;
+        case ExprType::ADDSUB:
+            pos=&static_cast<const AddSub*>(expr)->getAddList();
+            neg=&static_cast<const AddSub*>(expr)->getSubList();
+            break;
+        case ExprType::MULDIV:
+            pos=&static_cast<const MulDiv*>(expr)->getMulList();
+            neg=&static_cast<const MulDiv*>(expr)->getDivList();
+            break;
+        case ExprType::POWER:
+            operands[0]=static_cast<const Power*>(expr)->getBase();
+            operands[1]=static_cast<const Power*>(expr)->getExponent();
+            rec.pos_count=2;
+            break;
+        default:
+            return false;
+    }
+    if (pos) {
+        rec.pos_count=(uint32_t)pos->size();
+        rec.neg_count=(uint32_t)neg->size();
+    }
+
+    put(rec);
+    bool ok=true;
+    if (pos) {
+        for (auto& member : *pos) ok=ok && putRef(member);
+        for (auto& member : *neg) ok=ok && putRef(member);
+    } else if (operands[0]) {
+        ok=putRef(operands[0]) && putRef(operands[1]);
+    }
+    if (2*(count_+1) > slots_.size()) growIndex(count_+1);
+    addIndex(expr, count_++);
+    return ok;
+}
+
+bool CheckpointWriter::putRef(const Expr* expr) {
+    if (slots_.empty()) return false;
+    for (size_t i=slot(expr); slots_[i].expr; i=(i+1) & (slots_.size()-1)) {
+        if (slots_[i].expr == expr) {
+            put(slots_[i].index);
+            return true;
+        }
+    }
+    return false;
+}
+
+// to at most half full with exprs
+void CheckpointWriter::growIndex(size_t exprs) {
+    size_t size=64;
+    while (size < 2*exprs) size*=2;
+    if (size <= slots_.size()) return;
+    std::vector<Slot> old(size, Slot{nullptr, 0});
+    old.swap(slots_);
+    for (auto& entry : old) {
+        if (entry.expr) addIndex(entry.expr, entry.index);
+    }
+}
+
+size_t CheckpointWriter::slot(const Expr* expr) const {
+    uint64_t hash=(uint64_t)(uintptr_t)expr * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(hash >> 32) & (slots_.size()-1);
+}
+
+void CheckpointWriter::addIndex(const Expr* expr, uint32_t index) {
+    size_t i=slot(expr);
+    while (slots_[i].expr) i=(i+1) & (slots_.size()-1);
+    slots_[i]={expr, index};
+}
+
+bool CheckpointWriter::write(const std::string& path) {
+    endSection();
+    CheckpointHeader header;
+    memcpy(&header, buf_.data(), sizeof(header));
+    header.length=buf_.size();
+    header.header_crc=headerCrc(header, reinterpret_cast<const int32_t*>(
+        buf_.data()+sizeof(header)));
+    memcpy(&buf_[0], &header, sizeof(header));
+
+    const std::string tmp=path+".tmp";
+    FILE* file=fopen(tmp.c_str(), "wb");
+    if (!file) return false;
+    bool ok=fwrite(buf_.data(), 1, buf_.size(), file) == buf_.size() &&
+    fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok=(fclose(file) == 0) && ok;
+    ok=ok && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) unlink(tmp.c_str());
+    return ok;
+}
+
+CheckpointReader::~CheckpointReader() {
+    for (auto expr : exprs_) delete expr;
+    close();
+}
+
+void CheckpointReader::close() {
+    if (base_) munmap(const_cast<char*>(base_), size_);
+    base_=nullptr;
+    size_=0;
+    pos_=end_=0;
+}
+
+// the fields that tell searches apart
+static bool sameSearch(const CheckpointHeader& a, const CheckpointHeader& b)
+{
+    return a.target == b.target && a.int_size == b.int_size &&
+    a.ops == b.ops && a.max_dividend == b.max_dividend &&
+    a.max_divisor == b.max_divisor && a.integer_only == b.integer_only;
+}
+
+bool CheckpointReader::open(const std::string& path,
+                            const CheckpointHeader& expected,
+                            const std::vector<int>& elems)
+{
+    close();
+    int fd=::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CheckpointHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+    void* addr=mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) return false;
+    base_=static_cast<const char*>(addr);
+    size_=st.st_size;
+
+    CheckpointHeader header;
+    memcpy(&header, base_, sizeof(header));
+    const size_t first=sizeof(header)+header.elem_count*sizeof(int32_t);
+    bool ok=memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0
+    && header.version == CHECKPOINT_VERSION && header.length == size_ &&
+    header.elem_count == elems.size() && first <= size_ &&
+    sameSearch(header, expected);
+    if (ok) {
+        std::vector<int32_t> saved(header.elem_count);
+        memcpy(saved.data(), base_+sizeof(header),
+               header.elem_count*sizeof(int32_t));
+        ok=headerCrc(header, saved.data()) == header.header_crc &&
+        std::equal(saved.begin(), saved.end(), elems.begin());
+    }
+
+    // every section must be whole and match its checksum
+    for (size_t at=first; ok && at < size_; ) {
+        CheckpointSection section;
+        if (size_-at < sizeof(section)) {
+            ok=false;
+            break;
+        }
+        memcpy(&section, base_+at, sizeof(section));
+        at+=sizeof(section);
+        ok=section.length <= size_-at &&
+        crc32(base_+at, section.length) == section.crc;
+        at+=section.length;
+    }
+    if (!ok) close();
+    return ok;
+}
+
+bool CheckpointReader::section(CheckpointTag tag) {
+    CheckpointHeader header;
+    memcpy(&header, base_, sizeof(header));
+    size_t at=sizeof(header)+header.elem_count*sizeof(int32_t);
+    while (at < size_) {
+        CheckpointSection section;
+        memcpy(&section, base_+at, sizeof(section));
+        at+=sizeof(section);
+        if (section.tag == (uint32_t)tag) {
+            pos_=at;
+            end_=at+section.length;
+            return true;
+        }
+        at+=section.length;
+    }
+    return false;
+}
+
+bool CheckpointReader::getBytes(void* data, size_t size) {
+    if (end_-pos_ < size) return false;
+    memcpy(data, base_+pos_, size);
+    pos_+=size;
+    return true;
+}
+
+bool CheckpointReader::getRef(Expr*& expr) {
+    uint32_t index;
+    if (!get(index) || index >= exprs_.size()) return false;
+    expr=exprs_[index];
+    return true;
+}
+
+bool CheckpointReader::getMembers(uint32_t count, ExprList& list) {
+    list.clear();
+    for (uint32_t i=0; i<count; ++i) {
+        Expr* member;
+        if (!getRef(member)) return false;
+        list.push_back(member);
+    }
+    return true;
+}
+
+bool CheckpointReader::getExpr() {
+    CheckpointExpr rec;
+    if (!get(rec) || rec.pos_count > exprs_.size() ||
+        rec.neg_count > exprs_.size()) {
+        return false;
+    }
+    const ExprType type=(ExprType)rec.type;
+    if (type == ExprType::LITERAL) {
+        if (rec.pos_count || rec.neg_count) return false;
+        exprs_.push_back(new Literal(rec.value));
+        return true;
+    }
+
+    if (!getMembers(rec.pos_count, pos_list_) ||
+        !getMembers(rec.neg_count, neg_list_)) {
+        return false;
+    }
+    switch (type) {
+        case ExprType::ADDSUB:
+        case ExprType::MULDIV:
+            if (pos_list_.empty() || pos_list_.size()+neg_list_.size() < 2) {
+                return false;
+            }
+            if (type == ExprType::ADDSUB) {
+                exprs_.push_back(new AddSub(pos_list_, neg_list_));
+            } else {
+                exprs_.push_back(new MulDiv(pos_list_, neg_list_));
+            }
+            return true;
+        case ExprType::POWER:
+            if (pos_list_.size() != 2 || !neg_list_.empty()) return false;
+            exprs_.push_back(new Power(pos_list_.front(), pos_list_.back()));
+            return true;
+        default:
+            return false;
+    }
+}
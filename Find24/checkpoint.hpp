@@ -0,0 +1,166 @@
+//
+//  checkpoint.hpp
+//  Find24
+//
+
+#ifndef checkpoint_hpp
+#define checkpoint_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "expr.hpp"
+
+// Snapshot of the finished layers of a search, so that a long one can pick
+// up where it left off (see Find24Base::setCheckpoint()).
+//
+// Layout, all fields in native byte order:
+//   CheckpointHeader
+//   int32_t elems[elem_count]
+//   sections, each a CheckpointSection and length bytes of content:
+//     EXPRS        every expression, as a CheckpointExpr and the uint32_t
+//                  indexes of its members; members come before the
+//                  expressions made of them
+//     VALUES       for each subset: uint32_t size, int32_t numbers[size],
+//                  uint32_t value count, and for each value Int dividend,
+//                  Int divisor, uint32_t count and the indexes of its
+//                  expressions in ExprSet order
+//     CONSTRAINTS  for each subset: uint32_t size, int32_t numbers[size],
+//                  uint32_t value count, and Int dividend, Int divisor each
+//     COUNTERS     Find24Counters
+// Int is the integer type of the search (int_size bytes). header_crc and
+// the crc of each section are CRC-32s, so a file that was cut short or
+// damaged is never used. A snapshot is only used by the same search: same
+// target, numbers, limits and integer width.
+
+const char CHECKPOINT_MAGIC[4]={'F', '2', '4', 'C'};
+const uint32_t CHECKPOINT_VERSION=1;
+
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t length; // of the whole file, in bytes
+    int32_t target;
+    uint32_t elem_count;
+    uint32_t int_size;
+    uint32_t ops; // the SearchLimits
+    int64_t max_dividend;
+    int64_t max_divisor;
+    uint32_t integer_only;
+    uint32_t header_crc; // of the header up to here, and elems
+};
+
+enum class CheckpointTag : uint32_t { EXPRS, VALUES, CONSTRAINTS, COUNTERS };
+
+struct CheckpointSection {
+    uint32_t tag; // CheckpointTag
+    uint32_t crc;
+    uint64_t length;
+};
+
+// A LITERAL has a value and no members. An AddSub (MulDiv) has its added
+// (multiplied) members, then its subtracted (divided) ones, a Power its
+// base and exponent as two pos members.
+struct CheckpointExpr {
+    uint32_t type; // ExprType
+    int32_t value;
+    uint32_t pos_count;
+    uint32_t neg_count;
+};
+
+uint32_t crc32(const void* data, size_t size, uint32_t crc=0);
+
+// Builds a snapshot in memory, section after section, and writes it out
+// in one go.
+class CheckpointWriter {
+public:
+    // the fields of header that tell the search apart
+    CheckpointWriter(const CheckpointHeader& header,
+                     const std::vector<int>& elems);
+
+    // room for this many expressions
+    void reserve(size_t exprs);
+    
+    void beginSection(CheckpointTag tag);
+
+    template<typename T> void put(const T& value) {
+        putBytes(&value, sizeof(value));
+    }
+    void putBytes(const void* data, size_t size);
+
+    // Adds expr to EXPRS. Returns false if one of its members has not been
+    // added before.
+    bool putExpr(const Expr* expr);
+
+    // the index of an expression added by putExpr(), false if it was not
+    bool putRef(const Expr* expr);
+
+    // Writes to path.tmp and renames it to path once it is complete, so
+    // path is always either the old snapshot or the new one.
+    bool write(const std::string& path);
+
+private:
+    // the indexes of the expressions added, by address; open addressing,
+    // as there are millions of them
+    struct Slot {
+        const Expr* expr; // nullptr for an empty slot
+        uint32_t index;
+    };
+
+    std::vector<char> buf_;
+    size_t section_; // offset of the open section, 0 if none
+    std::vector<Slot> slots_; // a power of 2 of them
+    uint32_t count_; // of the expressions added
+
+    void growIndex(size_t exprs);
+    size_t slot(const Expr* expr) const;
+    void addIndex(const Expr* expr, uint32_t index);
+    void endSection();
+};
+
+// Maps a snapshot and rebuilds what is in it. The expressions it builds are
+// deleted with it, unless they are released.
+class CheckpointReader {
+public:
+    CheckpointReader() : base_(nullptr), size_(0), pos_(0), end_(0) { }
+    ~CheckpointReader();
+
+    // Returns false if path cannot be mapped, is not well formed, or is a
+    // snapshot of another search than the one header and elems describe
+    // (see CheckpointWriter).
+    bool open(const std::string& path, const CheckpointHeader& header,
+              const std::vector<int>& elems);
+
+    // moves to the content of the section with tag, false if there is none
+    bool section(CheckpointTag tag);
+    // whether the content of the section has all been read
+    bool atEnd() const { return pos_ == end_; }
+
+    template<typename T> bool get(T& value) {
+        return getBytes(&value, sizeof(value));
+    }
+    bool getBytes(void* data, size_t size);
+
+    // builds the next expression of EXPRS
+    bool getExpr();
+    // an expression built by getExpr(), by its index
+    bool getRef(Expr*& expr);
+
+    // hands the expressions built over to the caller
+    void release() { exprs_.clear(); }
+
+private:
+    const char* base_;
+    size_t size_;
+    size_t pos_; // in the current section
+    size_t end_;
+    std::vector<Expr*> exprs_;
+    ExprList pos_list_, neg_list_;
+
+    bool getMembers(uint32_t count, ExprList& list);
+    void close();
+};
+
+#endif /* checkpoint_hpp */
@@ -0,0 +1,330 @@
+//
+//  dagfile.cpp
+//  Find24
+//
+
+#include "dagfile.hpp"
+#include "literal.hpp"
+#include "addsub.hpp"
+#include "muldiv.hpp"
+#include "power.hpp"
+
+#include <map>
+#include <unordered_map>
+#include <stdio.h>
+#include <string.h>
+
+static bool isAddSub(DagOp op) {
+    return op == DagOp::ADD || op == DagOp::SUB;
+}
+
+static bool isMulDiv(DagOp op) {
+    return op == DagOp::MUL || op == DagOp::DIV;
+}
+
+static bool isLiteralRef(uint32_t ref) {
+    return (ref & 1) != 0;
+}
+
+static void putVarint(std::vector<unsigned char>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((unsigned char)(value | 0x80));
+        value>>=7;
+    }
+    out.push_back((unsigned char)value);
+}
+
+static bool getVarint(const unsigned char*& in, const unsigned char* end,
+                      uint64_t& value)
+{
+    value=0;
+    for (int shift=0; shift<64 && in<end; shift+=7) {
+        unsigned char byte=*in++;
+        value|=(uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// ref as it is written for the node at index
+static uint64_t relative(uint32_t ref, uint32_t index) {
+    if (isLiteralRef(ref)) return ref;
+    return (uint64_t)(index-(ref >> 1)) << 1;
+}
+
+// undoes relative(), false if ref does not point back from index
+static bool absolute(uint64_t& ref, uint32_t index) {
+    if (ref > UINT32_MAX) return false;
+    if (isLiteralRef((uint32_t)ref)) return true;
+    uint64_t distance=ref >> 1;
+    if (distance == 0 || distance > index) return false;
+    ref=(index-distance) << 1;
+    return true;
+}
+
+namespace {
+
+// Interns nodes, so equal sub-expressions and equal chain prefixes reached
+// through different parents become one node. Sub-expressions are shared by
+// pointer in a solution set, so exprs_ only needs to tell those apart; the
+// nodes of equal expressions that are not are merged by node() anyway.
+class DagBuilder {
+public:
+    // the reference to expr, see dagfile.hpp
+    uint32_t add(const Expr* expr) {
+        if (expr->getType() == ExprType::LITERAL) {
+            return (literal(expr) << 1) | 1;
+        }
+        auto it=exprs_.find(expr);
+        if (it != exprs_.end()) return it->second;
+        
+        uint32_t ret=node(top(expr));
+        exprs_.insert({expr, ret});
+        return ret;
+    }
+    
+    // Adds expr as a solution, after the nodes it needs.
+    void addRoot(const Expr* expr) {
+        DagNode root=top(expr);
+        roots_.push_back((uint32_t)nodes_.size());
+        nodes_.push_back(root);
+    }
+    
+    std::vector<DagNode> nodes_;
+    std::vector<uint32_t> roots_; // as indices
+    
+private:
+    std::unordered_map<const Expr*, uint32_t> exprs_;
+    std::map<std::pair<uint64_t, uint32_t>, uint32_t> index_;
+    
+    static uint32_t literal(const Expr* expr) {
+        return (uint32_t)static_cast<const Literal*>(expr)->getValue();
+    }
+    
+    // Same as add(), but the node for expr itself is returned instead of
+    // being added.
+    DagNode top(const Expr* expr) {
+        switch (expr->getType()) {
+            case ExprType::LITERAL:
+                return {DagOp::LITERAL, 0, literal(expr)};
+            case ExprType::ADDSUB: {
+                const AddSub* addsub=static_cast<const AddSub*>(expr);
+                return chain(addsub->getAddList(), addsub->getSubList(),
+                             DagOp::ADD, DagOp::SUB);
+            }
+            case ExprType::POWER:
+                return power(static_cast<const Power*>(expr));
+            default: {
+                const MulDiv* muldiv=static_cast<const MulDiv*>(expr);
+                return chain(muldiv->getMulList(), muldiv->getDivList(),
+                             DagOp::MUL, DagOp::DIV);
+            }
+        }
+    }
+    
+    uint32_t node(const DagNode& node) {
+        auto key=std::make_pair(((uint64_t)node.op << 32) | node.prefix,
+                                node.member);
+        auto it=index_.find(key);
+        if (it != index_.end()) return it->second;
+        uint32_t ret=(uint32_t)nodes_.size() << 1;
+        nodes_.push_back(node);
+        index_.insert({key, ret});
+        return ret;
+    }
+    
+    // Adds all but the last node of the chain for pos and neg, and returns
+    // that last one. Members are added first, so they always come before.
+    // The chain has at least two members.
+    DagNode chain(const ExprList& pos, const ExprList& neg, DagOp pos_op,
+                  DagOp neg_op)
+    {
+        std::vector<std::pair<DagOp, const Expr*>> members;
+        for (auto& expr : pos) members.push_back({pos_op, expr});
+        for (auto& expr : neg) members.push_back({neg_op, expr});
+        assert(members.size() >= 2);
+        DagNode ret={members[1].first, add(members[0].second),
+            add(members[1].second)};
+        for (size_t i=2; i<members.size(); ++i) {
+            ret={members[i].first, node(ret), add(members[i].second)};
+        }
+        return ret;
+    }
+    
+    DagNode power(const Power* expr) {
+        uint32_t base=add(expr->getBase());
+        return {DagOp::POW, base, add(expr->getExponent())};
+    }
+};
+
+}
+
+bool writeDagFile(const char* path, const ExprSet& exprs, int target) {
+    DagBuilder builder;
+    for (auto& expr : exprs) builder.addRoot(expr);
+    if (builder.nodes_.size() >= DAG_MAX_NODES) return false;
+    
+    std::vector<unsigned char> body;
+    size_t next_root=0;
+    for (uint32_t i=0; i<builder.nodes_.size(); ++i) {
+        const DagNode& node=builder.nodes_[i];
+        uint64_t root=0;
+        if (next_root < builder.roots_.size() &&
+            builder.roots_[next_root] == i) {
+            root=1;
+            ++next_root;
+        }
+        uint64_t tag=(uint64_t)node.op | root << 3;
+        if (node.op == DagOp::LITERAL) {
+            putVarint(body, tag | (uint64_t)node.member << 4);
+            continue;
+        }
+        putVarint(body, tag | relative(node.prefix, i) << 4);
+        putVarint(body, relative(node.member, i));
+    }
+    
+    DagHeader header;
+    memcpy(header.magic, DAG_MAGIC, sizeof(header.magic));
+    header.version=DAG_VERSION;
+    header.target=target;
+    header.node_count=(uint32_t)builder.nodes_.size();
+    header.root_count=(uint32_t)builder.roots_.size();
+    header.unused=0;
+    header.length=sizeof(header)+body.size();
+    
+    FILE* file=fopen(path, "wb");
+    if (!file) return false;
+    bool ok=fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(body.data(), 1, body.size(), file) == body.size();
+    return (fclose(file) == 0) && ok;
+}
+
+bool DagReader::open(const char* path) {
+    close();
+    FILE* file=fopen(path, "rb");
+    if (!file) return false;
+    std::vector<unsigned char> data;
+    unsigned char buffer[1 << 16];
+    size_t got;
+    while ((got=fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer+got);
+    }
+    bool ok=!ferror(file);
+    fclose(file);
+    
+    DagHeader header;
+    if (!ok || data.size() < sizeof(header)) return false;
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, DAG_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != DAG_VERSION || header.length != data.size() ||
+        !decode(data.data()+sizeof(header), data.size()-sizeof(header),
+                header)) {
+        close();
+        return false;
+    }
+    target_=header.target;
+    return true;
+}
+
+void DagReader::close() {
+    target_=0;
+    nodes_.clear();
+    roots_.clear();
+}
+
+// Every reference must point backwards, which also rules out cycles.
+bool DagReader::decode(const unsigned char* data, size_t size,
+                       const DagHeader& header)
+{
+    const unsigned char* end=data+size;
+    nodes_.reserve(header.node_count);
+    for (uint32_t i=0; i<header.node_count; ++i) {
+        uint64_t tag, prefix, member;
+        if (!getVarint(data, end, tag) || (tag & 7) > (uint64_t)DagOp::POW) {
+            return false;
+        }
+        DagOp op=(DagOp)(tag & 7);
+        if (tag & 8) roots_.push_back(i << 1);
+        prefix=tag >> 4;
+        if (op == DagOp::LITERAL) {
+            if (prefix > UINT32_MAX) return false;
+            nodes_.push_back({op, 0, (uint32_t)prefix});
+            continue;
+        }
+        if (!getVarint(data, end, member) || !absolute(prefix, i) ||
+            !absolute(member, i)) {
+            return false;
+        }
+        nodes_.push_back({op, (uint32_t)prefix, (uint32_t)member});
+    }
+    return data == end && roots_.size() == header.root_count;
+}
+
+// prints the members of the chain ending at ref, in order
+void DagReader::writeChain(ExprWriter& out, uint32_t ref, bool addsub) const
+{
+    if (isLiteralRef(ref)) {
+        writeNode(out, ref, true);
+        return;
+    }
+    const DagNode& node=nodes_[ref >> 1];
+    if (addsub ? !isAddSub(node.op) : !isMulDiv(node.op)) {
+        writeNode(out, ref, true);
+        return;
+    }
+    
+    writeChain(out, node.prefix, addsub);
+    static const char symbols[]="?+-*/";
+    out.put(symbols[(int)node.op]);
+    writeNode(out, node.member, true);
+}
+
+// mirrors Expr::write() of the expression types
+void DagReader::writeNode(ExprWriter& out, uint32_t ref, bool embed) const {
+    if (isLiteralRef(ref)) {
+        out.putInt(ref >> 1);
+        return;
+    }
+    const DagNode& node=nodes_[ref >> 1];
+    if (node.op == DagOp::LITERAL) {
+        out.putInt(node.member);
+        return;
+    }
+    if (node.op == DagOp::POW) {
+        writeOperand(out, node.prefix);
+        out.put('^');
+        writeOperand(out, node.member);
+        return;
+    }
+    
+    bool addsub=isAddSub(node.op);
+    if (addsub && embed) out.put('(');
+    writeChain(out, ref, addsub);
+    if (addsub && embed) out.put(')');
+}
+
+// an operand of ^, see Power::write()
+void DagReader::writeOperand(ExprWriter& out, uint32_t ref) const {
+    bool literal=isLiteralRef(ref) ||
+    nodes_[ref >> 1].op == DagOp::LITERAL;
+    if (!literal) out.put('(');
+    writeNode(out, ref, false);
+    if (!literal) out.put(')');
+}
+
+void DagReader::print(ExprWriter& out, OutputFormat format) const {
+    for (auto root : roots_) {
+        if (format == OutputFormat::JSON) {
+            out.put("{\"expr\":\"");
+            writeNode(out, root, false);
+            out.put("\",\"target\":");
+            out.putInt(target_);
+            out.put("}\n");
+        } else {
+            writeNode(out, root, false);
+            out.put('=');
+            out.putInt(target_);
+            out.put('\n');
+        }
+    }
+}
@@ -0,0 +1,96 @@
+//
+//  dagfile.hpp
+//  Find24
+//
+
+#ifndef dagfile_hpp
+#define dagfile_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "expr.hpp"
+#include "exprwriter.hpp"
+#include "find24.hpp"
+
+// Binary form of a solution set. Expressions share their sub-expressions,
+// so instead of repeating them as text, every distinct sub-expression is
+// stored once as a node and referred to. An AddSub (MulDiv) is stored as a
+// chain that starts with its first member and adds one member per node, so
+// expressions that only differ in their last members share the rest of the
+// chain. A POW node is just base (prefix) ^ exponent (member).
+//
+// Layout:
+//   DagHeader                in native byte order
+//   node_count nodes         varints, see below
+// A reference to a literal holds its value, (value << 1) | 1, and one to a
+// node the distance back to it, (current-node) << 1, so nodes only refer
+// to nodes before them. Literals are only nodes of their own when they are
+// a solution. Every node is
+//   varint  op | root << 3 | prefix << 4     op is a DagOp
+//   varint  member                           unless op is LITERAL
+// where a LITERAL node has its value in place of prefix. The root nodes are
+// the solutions, in ExprSet order; no other node refers to them, since
+// every solution uses all the input numbers. Each one comes right after
+// the nodes it adds, so most references are short.
+
+const char DAG_MAGIC[4]={'F', '2', '4', 'D'};
+const uint32_t DAG_VERSION=2;
+// a reference has 31 bits, so no file has this many nodes
+const uint32_t DAG_MAX_NODES=1u << 31;
+
+struct DagHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t length; // of the whole file, in bytes
+    int32_t target;
+    uint32_t node_count;
+    uint32_t root_count;
+    uint32_t unused;
+};
+
+enum class DagOp : uint32_t { LITERAL, ADD, SUB, MUL, DIV, POW };
+
+// A node once it has been read, with the references made absolute: a node
+// reference is its index << 1. For LITERAL, member is the value. Otherwise
+// the node is prefix followed by op and member; a prefix that is not itself
+// an ADD/SUB (MUL/DIV) node is the first member.
+struct DagNode {
+    DagOp op;
+    uint32_t prefix;
+    uint32_t member;
+};
+
+// Returns false if the file cannot be written, or if exprs would take
+// DAG_MAX_NODES nodes or more.
+bool writeDagFile(const char* path, const ExprSet& exprs, int target);
+
+// The solutions of a file written by writeDagFile(), read into memory.
+class DagReader {
+public:
+    DagReader() : target_(0) { }
+    
+    // Returns false if the file cannot be read or is not well formed.
+    bool open(const char* path);
+    void close();
+    
+    int getTarget() const { return target_; }
+    size_t size() const { return roots_.size(); }
+    
+    // same output as writeExprSet()
+    void print(ExprWriter& out, OutputFormat format) const;
+    
+private:
+    int target_;
+    std::vector<DagNode> nodes_;
+    std::vector<uint32_t> roots_; // as references
+    
+    bool decode(const unsigned char* data, size_t size,
+                const DagHeader& header);
+    void writeNode(ExprWriter& out, uint32_t ref, bool embed) const;
+    void writeChain(ExprWriter& out, uint32_t ref, bool addsub) const;
+    void writeOperand(ExprWriter& out, uint32_t ref) const;
+};
+
+#endif /* dagfile_hpp */
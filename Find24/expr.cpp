@@ -13,6 +13,10 @@ int cmpExpr(const Expr* left, const Expr* right) {
     Rank lrank=left->getRank();
     Rank rrank=right->getRank();
     if (lrank != rrank) return (lrank>rrank)?1:-1;
+    // only POWER can share a rank with another type, see typeBits()
+    ExprType ltype=left->getType();
+    ExprType rtype=right->getType();
+    if (ltype != rtype) return (ltype>rtype)?1:-1;
     return left->cmp(*right);
 }
 
@@ -52,8 +56,14 @@ void mergeList(ExprList& to, const ExprList& from) {
 static const int BITS_FOR_ETYPE=2;
 static const int MAX_ELEMS=sizeof(Rank)*8/BITS_FOR_ETYPE-1;
 
+// POWER does not fit in BITS_FOR_ETYPE and shares the code of NONE. Ranks
+// are only a quick first comparison, cmpExpr() sorts out the ties.
+static Rank typeBits(ExprType etype) {
+    return (etype == ExprType::POWER) ? (Rank)ExprType::NONE : (Rank)etype;
+}
+
 RankBuilder::RankBuilder(ExprType etype) :
-rank_(((Rank)etype) << (BITS_FOR_ETYPE*MAX_ELEMS)),
+rank_(typeBits(etype) << (BITS_FOR_ETYPE*MAX_ELEMS)),
 avail_(MAX_ELEMS) { }
 
 bool RankBuilder::addExprList(const ExprList& exprs)
@@ -61,7 +71,7 @@ bool RankBuilder::addExprList(const ExprList& exprs)
     for (auto& expr : exprs) {
         if (avail_>0) {
             --avail_;
-            rank_|=((Rank)expr->getType())
+            rank_|=typeBits(expr->getType())
             << (avail_*BITS_FOR_ETYPE);
         } else {
             return false;
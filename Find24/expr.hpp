@@ -10,9 +10,10 @@
 #define expr_hpp
 
 #include "rational.hpp"
+#include "exprwriter.hpp"
 #include <list>
 
-enum class ExprType { NONE, LITERAL, ADDSUB, MULDIV };
+enum class ExprType { NONE, LITERAL, ADDSUB, MULDIV, POWER };
 
 typedef uint32_t Rank;
 
@@ -20,7 +21,14 @@ typedef uint32_t Rank;
 class Expr {
 public:
     virtual int cmp(const Expr& other) const = 0;
-    virtual std::string toString(bool embed) const = 0;
+    // embed means the expression is an operand of another one, and needs
+    // parentheses if it binds more loosely
+    virtual void write(ExprWriter& out, bool embed) const = 0;
+    std::string toString(bool embed) const {
+        ExprWriter out;
+        write(out, embed);
+        return out.str();
+    }
     virtual ExprType getType() const = 0;
     virtual Rank getRank() const = 0;
     virtual ~Expr() { }
@@ -0,0 +1,36 @@
+//
+//  exprcost.hpp
+//  Find24
+//
+
+#ifndef exprcost_hpp
+#define exprcost_hpp
+
+#include <functional>
+
+// What makes a solution look simple, counted over its canonical form (so
+// that a+(b+c) and (a+b)+c, being the same AddSub, count the same). Every
+// solution uses all numbers with one operator fewer, so the operators are
+// told apart by kind instead.
+struct ExprFeatures {
+    int fractions; // sub-expressions whose value is not a whole number
+    int depth; // of nested AddSub/MulDiv, a literal is 0
+    int divisions;
+    int subtractions;
+    bool fraction; // the value of the expression itself is not whole
+    
+    ExprFeatures() : fractions(0), depth(0), divisions(0), subtractions(0),
+    fraction(false) { }
+};
+
+// Lower is simpler. Any function of the features works, the search keeps
+// the lowest cost solutions of all anyway.
+typedef std::function<double(const ExprFeatures&)> CostFunction;
+
+// fractions first, then nesting, then the less friendly operators
+inline double defaultCost(const ExprFeatures& f) {
+    return 100.0*f.fractions + 10.0*f.depth + 2.0*f.divisions +
+    f.subtractions;
+}
+
+#endif /* exprcost_hpp */
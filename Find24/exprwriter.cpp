@@ -0,0 +1,32 @@
+//
+//  exprwriter.cpp
+//  Find24
+//
+
+#include "exprwriter.hpp"
+#include <algorithm>
+
+void ExprWriter::putInt(int64_t val) {
+    char tmp[24];
+    char* p=tmp+sizeof(tmp);
+    uint64_t u=(val<0) ? -(uint64_t)val : (uint64_t)val;
+    do {
+        *--p=(char)('0'+u%10);
+        u/=10;
+    } while (u != 0);
+    if (val<0) *--p='-';
+    put(p, tmp+sizeof(tmp)-p);
+}
+
+void ExprWriter::flush() {
+    if (!file_ || len_ == 0) return;
+    fwrite(buf_.data(), 1, len_, file_);
+    len_=0;
+}
+
+void ExprWriter::makeRoom(size_t n) {
+    flush();
+    if (len_+n > buf_.size()) {
+        buf_.resize(std::max(buf_.size()*2, len_+n));
+    }
+}
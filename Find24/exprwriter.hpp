@@ -0,0 +1,62 @@
+//
+//  exprwriter.hpp
+//  Find24
+//
+
+#ifndef exprwriter_hpp
+#define exprwriter_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// TEXT prints "expr=target" lines, JSON prints one object per line
+enum class OutputFormat { TEXT, JSON };
+
+// Output buffer that expressions are printed into directly, without
+// building temporary strings. With a file, the buffer is written out in
+// large chunks whenever it fills up; without one it just grows, and str()
+// returns everything written so far.
+class ExprWriter {
+public:
+    ExprWriter() : file_(nullptr), buf_(64), len_(0) { }
+    
+    explicit ExprWriter(FILE* file, size_t size=1<<16) :
+    file_(file), buf_(size), len_(0) { }
+    
+    ~ExprWriter() { flush(); }
+    
+    void put(char c) {
+        if (len_ == buf_.size()) makeRoom(1);
+        buf_[len_++]=c;
+    }
+    
+    void put(const char* s, size_t n) {
+        if (len_+n > buf_.size()) makeRoom(n);
+        memcpy(&buf_[len_], s, n);
+        len_+=n;
+    }
+    
+    void put(const char* s) { put(s, strlen(s)); }
+    
+    void putInt(int64_t val);
+    
+    // no-op without a file
+    void flush();
+    
+    std::string str() const { return std::string(buf_.data(), len_); }
+
+    // drops what was written without a file, keeping the buffer for reuse
+    void clear() { if (!file_) len_=0; }
+
+private:
+    FILE* file_;
+    std::vector<char> buf_;
+    size_t len_;
+    
+    void makeRoom(size_t n);
+};
+
+#endif /* exprwriter_hpp */
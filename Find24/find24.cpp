@@ -10,68 +10,520 @@
 #include "literal.hpp"
 #include "addsub.hpp"
 #include "muldiv.hpp"
+#include "opset.hpp"
 #include "selectk.hpp"
+#include "checkpoint.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <iomanip>
+#include <unordered_map>
+#include <thread>
+#include <system_error>
 
-void Find24::run(bool debug) {
+void Find24Base::printCounters() const {
+    if (stop_.status != Status::OK) {
+        std::cout << "stopped early: " <<
+        ((stop_.status == Status::TIMEOUT) ? "timeout" : "cancelled") <<
+        std::endl;
+    }
+    std::cout << "counters: " << std::endl <<
+    "subsets=" << counters_.subsets << std::endl <<
+    "combos=" << counters_.combos << std::endl <<
+    "newvalues=" << counters_.newvalues << std::endl <<
+    "valcombos=" << counters_.valcombos << std::endl <<
+    "exprcombos=" << counters_.exprcombos << std::endl <<
+    "uniqexprs=" << counters_.uniqexprs << std::endl <<
+    "csubsets=" << counters_.csubsets << std::endl <<
+    "ccombos=" << counters_.ccombos << std::endl <<
+    "cvalcombos=" << counters_.cvalcombos << std::endl <<
+    "dups(+-*/^)=" << counters_.dups[0] << " " << counters_.dups[1] << " " <<
+    counters_.dups[2] << " " << counters_.dups[3] << " " <<
+    counters_.dups[4] << std::endl <<
+    std::endl;
+    
+    if (profile_) printPhases();
+}
+
+void Find24Base::printPhases() const {
+    std::cout << std::left << std::setw(12) << "phase" << std::right <<
+    std::setw(5) << "size" << std::setw(10) << "millis" <<
+    std::setw(11) << "valcombos" << std::setw(11) << "exprcombos" <<
+    std::setw(11) << "uniqexprs" << std::setw(11) << "dups" <<
+    std::setw(11) << "cvalcombos";
+    for (int e=0; e<PerfCounters::EVENTS; ++e) {
+        if (perf_ && perf_->isValid((PerfCounters::Event)e)) {
+            std::cout << std::setw(14) << PerfCounters::name((PerfCounters::Event)e);
+        }
+    }
+    std::cout << std::endl;
+    
+    for (auto& phase : phases_) {
+        std::cout << std::left << std::setw(12) << phase.name << std::right <<
+        std::setw(5) << phase.size << std::setw(10) << std::fixed <<
+        std::setprecision(2) << phase.millis <<
+        std::setw(11) << phase.counters.valcombos <<
+        std::setw(11) << phase.counters.exprcombos <<
+        std::setw(11) << phase.counters.uniqexprs <<
+        std::setw(11) << phase.counters.totalDups() <<
+        std::setw(11) << phase.counters.cvalcombos;
+        for (int e=0; e<PerfCounters::EVENTS; ++e) {
+            if (perf_ && perf_->isValid((PerfCounters::Event)e)) {
+                std::cout << std::setw(14) << phase.perf.values[e];
+            }
+        }
+        std::cout << std::endl;
+    }
+    
+    if (perf_ && !perf_->anyValid()) {
+        std::cout << "hardware counters unavailable (" << perf_->error() <<
+        ")" << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+// Adds the work done during its lifetime to phases_ when profiling.
+class Find24Base::Phase {
+public:
+    Phase(Find24Base& p, const char* name, int size) : p_(p) {
+        if (p_.progress_) p_.startPhaseProgress(name, size);
+        if (!p_.profile_) return;
+        if (!p_.perf_) p_.perf_.reset(new PerfCounters());
+        stats_.name=name;
+        stats_.size=size;
+        counters_=p_.counters_;
+        perf_=p_.perf_->read();
+        start_=Clock::now();
+    }
+    
+    ~Phase() {
+        if (p_.progress_) p_.endPhaseProgress();
+        if (!p_.profile_) return;
+        stats_.millis=std::chrono::duration<double, std::milli>(
+            Clock::now()-start_).count();
+        PerfCounters::Sample perf=p_.perf_->read();
+        for (int e=0; e<PerfCounters::EVENTS; ++e) {
+            stats_.perf.values[e]=perf.values[e]-perf_.values[e];
+        }
+        const Counters& now=p_.counters_;
+        Counters& diff=stats_.counters;
+        diff.subsets=now.subsets-counters_.subsets;
+        diff.combos=now.combos-counters_.combos;
+        diff.newvalues=now.newvalues-counters_.newvalues;
+        diff.valcombos=now.valcombos-counters_.valcombos;
+        diff.exprcombos=now.exprcombos-counters_.exprcombos;
+        diff.uniqexprs=now.uniqexprs-counters_.uniqexprs;
+        diff.csubsets=now.csubsets-counters_.csubsets;
+        diff.ccombos=now.ccombos-counters_.ccombos;
+        diff.cvalcombos=now.cvalcombos-counters_.cvalcombos;
+        for (int op=0; op<5; ++op) {
+            diff.dups[op]=now.dups[op]-counters_.dups[op];
+        }
+        p_.phases_.push_back(stats_);
+    }
+    
+private:
+    Find24Base& p_;
+    PhaseStats stats_;
+    Counters counters_;
+    PerfCounters::Sample perf_;
+    Clock::time_point start_;
+};
+
+static int choose(int n, int k) {
+    int ret=1;
+    for (int i=1; i<=k; ++i) ret=ret*(n-k+i)/i;
+    return ret;
+}
+
+// the phases of buildLayers(), subsets of size k take C(n, k) picks (the
+// constraints for n-k numbers too)
+void Find24Base::startProgress() {
+    if (!progress_) return;
+    const int n=(int)elems_.size();
+    where_=Find24Progress();
+    where_.phase="";
+    where_.eta=-1;
+    for (int k=2; k<=n/2; ++k) where_.total_all+=choose(n, k);
+    for (int k=1; k<=(n-1)/2; ++k) where_.total_all+=choose(n, k);
+    for (int k=n/2+1; k<=n; ++k) where_.total_all+=choose(n, k);
+    run_start_=Clock::now();
+}
+
+void Find24Base::startPhaseProgress(const char* name, int size) {
+    where_.phase=name;
+    where_.size=size;
+    where_.done=0;
+    where_.total=choose((int)elems_.size(), size);
+    phase_start_=Clock::now();
+    reportProgress();
+}
+
+// stopped early, the subsets left are not done
+void Find24Base::endPhaseProgress() {
+    if (stop_.status == Status::OK) {
+        where_.done_all+=where_.total-where_.done;
+        where_.done=where_.total;
+    }
+    reportProgress();
+}
+
+void Find24Base::reportProgress() {
+    const Clock::time_point now=Clock::now();
+    where_.values=counters_.newvalues;
+    where_.exprs=counters_.uniqexprs;
+    where_.seconds=std::chrono::duration<double>(now-run_start_).count();
+    where_.eta=-1;
+    if (where_.done > 0) {
+        double phase=std::chrono::duration<double>(now-phase_start_).count();
+        where_.eta=phase*(where_.total-where_.done)/where_.done;
+    }
+    progress_(where_);
+}
+
+// Features of every expression built so far, and a bounded heap of the
+// best solutions for each root value.
+class Find24Base::Ranker {
+public:
+    Ranker(int k, const CostFunction& cost) : k_(k), cost_(cost) { }
+    
+    void addLiteral(const Expr* expr) {
+        features_[expr]=ExprFeatures();
+    }
+    
+    // the features of the canonical form of left op right, worked out from
+    // those of left and right: a half of the same type is merged into the
+    // result, so it no longer counts as a sub-expression of its own
+    ExprFeatures combine(const Expr* left, const Expr* right, Op op,
+                         bool fraction) const
+    {
+        const ExprType type=opType(op);
+        const bool inverse=(op == Op::MINUS || op == Op::DIVISION);
+        int lpos, lneg, rpos, rneg;
+        ExprFeatures l=part(left, type, lpos, lneg);
+        ExprFeatures r=part(right, type, rpos, rneg);
+        int neg=lneg+(inverse ? rpos : rneg);
+        
+        ExprFeatures ret;
+        ret.fraction=fraction;
+        ret.fractions=l.fractions+r.fractions+(fraction ? 1 : 0);
+        ret.depth=std::max(l.depth, r.depth)+1;
+        ret.divisions=l.divisions+r.divisions;
+        ret.subtractions=l.subtractions+r.subtractions;
+        if (type == ExprType::ADDSUB) {
+            ret.subtractions+=neg;
+        } else if (type == ExprType::MULDIV) {
+            ret.divisions+=neg;
+        }
+        return ret;
+    }
+    
+    // the features of expr, worked out from those of its members, which
+    // must be known already; fraction is whether its value is not whole
+    void add(const Expr* expr, bool fraction) {
+        ExprFeatures ret;
+        ret.fraction=fraction;
+        ret.fractions=(fraction ? 1 : 0);
+        switch (expr->getType()) {
+            case ExprType::LITERAL:
+                break;
+            case ExprType::ADDSUB: {
+                const AddSub* addsub=static_cast<const AddSub*>(expr);
+                addMembers(ret, addsub->getAddList());
+                addMembers(ret, addsub->getSubList());
+                ret.subtractions+=(int)addsub->getSubList().size();
+                break;
+            }
+            case ExprType::MULDIV: {
+                const MulDiv* muldiv=static_cast<const MulDiv*>(expr);
+                addMembers(ret, muldiv->getMulList());
+                addMembers(ret, muldiv->getDivList());
+                ret.divisions+=(int)muldiv->getDivList().size();
+                break;
+            }
+            default: {
+                const Power* power=static_cast<const Power*>(expr);
+                addMember(ret, power->getBase());
+                addMember(ret, power->getExponent());
+                break;
+            }
+        }
+        features_[expr]=ret;
+    }
+    
+    double cost(const ExprFeatures& features) const {
+        return cost_(features);
+    }
+    
+    // whether a new expression of this cost would make the top k of exprs,
+    // expr is only needed to break a tie with the k-th best
+    bool beats(const ExprSet& exprs, double cost, const Expr* expr) const {
+        auto it=heaps_.find(&exprs);
+        if (it == heaps_.end() || (int)it->second.size() < k_) return true;
+        const Entry& worst=it->second.front();
+        if (cost != worst.cost) return cost < worst.cost;
+        return !expr || cmpExpr(expr, worst.expr) < 0;
+    }
+    
+    // takes expr, which is not in exprs yet, and drops the costliest
+    // expression of exprs when there are more than k
+    void insert(ExprSet& exprs, std::unique_ptr<Expr>& expr,
+                const ExprFeatures& features, double cost)
+    {
+        features_[expr.get()]=features;
+        std::vector<Entry>& heap=heaps_[&exprs];
+        heap.push_back({cost, expr.get()});
+        std::push_heap(heap.begin(), heap.end(), better);
+        exprs.insert(expr.release());
+        if ((int)heap.size() > k_) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            Expr* worst=heap.back().expr;
+            heap.pop_back();
+            exprs.erase(worst);
+            features_.erase(worst);
+            delete worst;
+        }
+    }
+    
+    // cheapest first
+    std::vector<const Expr*> rank(const ExprSet& exprs) const {
+        std::vector<Entry> entries;
+        for (auto expr : exprs) {
+            entries.push_back({cost_(features_.at(expr)), expr});
+        }
+        std::sort(entries.begin(), entries.end(), better);
+        std::vector<const Expr*> ret;
+        for (auto& entry : entries) ret.push_back(entry.expr);
+        return ret;
+    }
+    
+private:
+    struct Entry {
+        double cost;
+        Expr* expr;
+    };
+    
+    int k_;
+    CostFunction cost_;
+    std::unordered_map<const Expr*, ExprFeatures> features_;
+    std::map<const ExprSet*, std::vector<Entry>> heaps_;
+    
+    // the order of the results, which makes the heap a max-heap
+    static bool better(const Entry& a, const Entry& b) {
+        if (a.cost != b.cost) return a.cost < b.cost;
+        return cmpExpr(a.expr, b.expr) < 0;
+    }
+    
+    // one member of an expression more, to the features of that expression
+    void addMember(ExprFeatures& features, const Expr* member) const {
+        const ExprFeatures& f=features_.at(member);
+        features.fractions+=f.fractions;
+        features.depth=std::max(features.depth, f.depth+1);
+        features.divisions+=f.divisions;
+        features.subtractions+=f.subtractions;
+    }
+    
+    void addMembers(ExprFeatures& features, const ExprList& members) const {
+        for (auto member : members) addMember(features, member);
+    }
+    
+    ExprFeatures part(const Expr* expr, ExprType type, int& pos,
+                      int& neg) const
+    {
+        ExprFeatures ret=features_.at(expr);
+        if (expr->getType() != type || type == ExprType::POWER) {
+            pos=1;
+            neg=0;
+            return ret;
+        }
+        if (type == ExprType::ADDSUB) {
+            const AddSub* addsub=static_cast<const AddSub*>(expr);
+            pos=(int)addsub->getAddList().size();
+            neg=(int)addsub->getSubList().size();
+            ret.subtractions-=neg;
+        } else {
+            const MulDiv* muldiv=static_cast<const MulDiv*>(expr);
+            pos=(int)muldiv->getMulList().size();
+            neg=(int)muldiv->getDivList().size();
+            ret.divisions-=neg;
+        }
+        ret.depth-=1;
+        if (ret.fraction) ret.fractions-=1;
+        return ret;
+    }
+};
+
+Find24Base::Find24Base(int target, const std::vector<int>& elems) :
+target_(target), elems_(elems), workers_(1), profile_(false),
+checkpoint_interval_(Clock::duration::zero()),
+checkpoint_cost_(Clock::duration::zero()), checkpoint_subsets_(0),
+count_only_(false), count_(0)
+{
+    std::sort(elems_.begin(), elems_.end());
+}
+
+Find24Base::~Find24Base() { }
+
+void Find24Base::setTopK(int k, const CostFunction& cost) {
+    ranker_.reset(new Ranker(k, cost));
+}
+
+template<typename Int>
+Find24Base::Status BasicFind24<Int>::run(bool debug) {
     buildSolutionMap();
     
     if (debug) {
-        std::cout << "counters: " << std::endl <<
-        "subsets=" << counters_.subsets << std::endl <<
-        "combos=" << counters_.combos << std::endl <<
-        "newvalues=" << counters_.newvalues << std::endl <<
-        "valcombos=" << counters_.valcombos << std::endl <<
-        "exprcombos=" << counters_.exprcombos << std::endl <<
-        "uniqexprs=" << counters_.uniqexprs << std::endl <<
-        "csubsets=" << counters_.csubsets << std::endl <<
-        "ccombos=" << counters_.ccombos << std::endl <<
-        "cvalcombos=" << counters_.cvalcombos << std::endl <<
-        std::endl;
+        printCounters();
     }
+    
+    return stop_.status;
 }
 
-std::vector<std::string> Find24::getExprs() const {
+template<typename Int>
+std::vector<std::string> BasicFind24<Int>::getExprs() const {
     std::vector<std::string> ret;
+    const ExprSet* exprs=getExprSet();
+    if (!exprs) {
+        return ret;
+    }
+    
+    for (auto& expr : *exprs) {
+        ret.push_back(expr->toString(false));
+    }
+    
+    return ret;
+}
+
+template<typename Int>
+const ExprSet* BasicFind24<Int>::getExprSet() const {
+    if (stop_.status != Status::OK) {
+        return nullptr;
+    }
+    
     auto it=solution_.find(elems_);
     if (it == solution_.end()) {
         std::cerr << "Oops, something is wrong!" << std::endl;
-        return ret;
+        return nullptr;
     }
     
     auto it2=it->second.find(Rational(target_));
-    if (it2 == it->second.end()) {
-        return ret;
+    if (it2 == it->second.end() || it2->second.empty()) {
+        return nullptr;
     }
     
-    for (auto& expr : it2->second) {
-        ret.push_back(expr->toString(false));
+    return &it2->second;
+}
+
+void writeExpr(ExprWriter& out, const Expr* expr, int target,
+               OutputFormat format)
+{
+    if (format == OutputFormat::JSON) {
+        out.put("{\"expr\":\"");
+        expr->write(out, false);
+        out.put("\",\"target\":");
+        out.putInt(target);
+        out.put("}\n");
+    } else {
+        expr->write(out, false);
+        out.put('=');
+        out.putInt(target);
+        out.put('\n');
     }
-    
-    return ret;
 }
 
-void Find24::addLiterals()
+void writeExprSet(ExprWriter& out, const ExprSet& exprs, int target,
+                  OutputFormat format)
+{
+    for (auto& expr : exprs) {
+        writeExpr(out, expr, target, format);
+    }
+}
+
+// saturates at limit, which is all chooseIntWidth() needs to know
+static uint64_t boundedProduct(uint64_t left, uint64_t right, uint64_t limit) {
+    unsigned __int128 ret=(unsigned __int128)left*right;
+    return (ret > limit) ? limit : (uint64_t)ret;
+}
+
+IntWidth chooseIntWidth(int target, const std::vector<int>& elems,
+                        const SearchLimits& limits)
+{
+    const uint64_t limit=1ULL<<63;
+    const SearchLimits effective=limits.effective();
+    uint64_t bound=std::max<uint64_t>(std::abs((int64_t)target), 1);
+    for (auto elem : elems) {
+        bound=boundedProduct(bound, std::max<uint64_t>(
+                                std::abs((int64_t)elem), 1), limit);
+        bound=boundedProduct(bound, 2, limit);
+    }
+    // only the limits keep powers in check
+    if (effective.allows(SearchLimits::POWER)) bound=limit;
+    if (effective.max_dividend > 0 && effective.max_divisor > 0) {
+        // the literals and the target are not checked against the limits
+        uint64_t largest=std::max(effective.max_dividend,
+                                  effective.max_divisor);
+        largest=std::max<uint64_t>(largest, std::abs((int64_t)target));
+        for (auto elem : elems) {
+            largest=std::max<uint64_t>(largest, std::abs((int64_t)elem));
+        }
+        // a result is only checked once it is narrowed to Int
+        bound=std::min(bound, boundedProduct(2*largest, largest, limit));
+    }
+    if (bound < (1ULL<<31)) return IntWidth::INT32;
+    if (bound < limit) return IntWidth::INT64;
+    return IntWidth::INT128; // could overflow, there is nothing wider
+}
+
+template<typename Int>
+void BasicFind24<Int>::addLiterals()
 {
     for (auto& elem : elems_) {
         NumVec key = {elem};
         if (!solution_.count(key)) {
             // avoid duplicated literals
+            Literal* literal=new Literal(elem);
             ValExprMap value = {
-                {elem, {new Literal(elem)}}
+                {elem, {literal}}
             };
             solution_.insert({key, value});
+            if (ranker_) ranker_->addLiteral(literal);
             ++counters_.subsets;
         }
     }
 }
 
-void Find24::addRootConstraint() {
+template<typename Int>
+void BasicFind24<Int>::addRootConstraint() {
     constraint_.insert({elems_, {target_}});
 }
 
+// Only the root is ranked, so the layers below are built without their
+// features, which are worked out here from the smallest subsets up: the
+// members of an expression are always from smaller ones.
+template<typename Int>
+void BasicFind24<Int>::addFeatures() {
+    std::vector<std::vector<const ValExprMap*>> layers(elems_.size());
+    for (auto& key_value : solution_) {
+        const size_t size=key_value.first.size();
+        if (size > 1 && size < elems_.size()) {
+            layers[size].push_back(&key_value.second);
+        }
+    }
+    for (auto& layer : layers) {
+        for (auto value : layer) {
+            for (auto& val_exprs : *value) {
+                for (auto expr : val_exprs.second) {
+                    ranker_->add(expr, val_exprs.first.divisor() != 1);
+                }
+            }
+        }
+    }
+}
+
 // s1 = from[sel], s2 = from - s1, from/sel/s1/s2 are all sorted
 static void splitVec(const NumVec& from, int sel[], int k, NumVec& s1,
                      NumVec& s2)
@@ -89,128 +541,475 @@ static void splitVec(const NumVec& from, int sel[], int k, NumVec& s1,
     }
 }
 
-class Find24::ValueBuilder {
+static uint64_t hashMembers(const ExprList& members) {
+    uint64_t ret=0;
+    for (auto& expr : members) {
+        ret+=(uint64_t)(uintptr_t)expr * 0x9E3779B97F4A7C15ULL;
+    }
+    return ret;
+}
+
+// the two member lists expr contributes to a combined AddSub/MulDiv
+static void hashMembers(const Expr* expr, ExprType type, uint64_t& pos,
+                        uint64_t& neg)
+{
+    if (expr->getType() != type || type == ExprType::POWER) {
+        pos=(uint64_t)(uintptr_t)expr * 0x9E3779B97F4A7C15ULL;
+        neg=0;
+    } else if (type == ExprType::ADDSUB) {
+        const AddSub* addsub=static_cast<const AddSub*>(expr);
+        pos=hashMembers(addsub->getAddList());
+        neg=hashMembers(addsub->getSubList());
+    } else {
+        const MulDiv* muldiv=static_cast<const MulDiv*>(expr);
+        pos=hashMembers(muldiv->getMulList());
+        neg=hashMembers(muldiv->getDivList());
+    }
+}
+
+// Every sub-expression is unique within its subset and value, so the
+// member addresses identify the canonical form that combining left and
+// right (with type and inverse as the operator) gives, no matter which
+// split it comes from. The worker threads share those addresses.
+static uint64_t hashCombined(const Expr* left, const Expr* right,
+                             ExprType type, bool inverse)
+{
+    uint64_t lpos, lneg, rpos, rneg;
+    hashMembers(left, type, lpos, lneg);
+    hashMembers(right, type, rpos, rneg);
+    if (inverse) std::swap(rpos, rneg);
+    return (lpos+rpos) ^ ((lneg+rneg) * 0xC2B2AE3D27D4EB4FULL);
+}
+
+static int shardOf(const Expr* left, const Expr* right, ExprType type,
+                   bool inverse, int shards)
+{
+    return (int)((hashCombined(left, right, type, inverse) >> 32) % shards);
+}
+
+typedef std::vector<const Expr*> MemberVec;
+
+// appends the members expr contributes to a combined expression of type
+static void addMembers(const Expr* expr, ExprType type, MemberVec& pos,
+                       MemberVec& neg)
+{
+    if (expr->getType() != type || type == ExprType::POWER) {
+        pos.push_back(expr);
+        return;
+    }
+    const ExprList* plist;
+    const ExprList* nlist;
+    if (type == ExprType::ADDSUB) {
+        plist=&static_cast<const AddSub*>(expr)->getAddList();
+        nlist=&static_cast<const AddSub*>(expr)->getSubList();
+    } else {
+        plist=&static_cast<const MulDiv*>(expr)->getMulList();
+        nlist=&static_cast<const MulDiv*>(expr)->getDivList();
+    }
+    pos.insert(pos.end(), plist->begin(), plist->end());
+    neg.insert(neg.end(), nlist->begin(), nlist->end());
+}
+
+// The expressions a ValueBuilder has built, by hashCombined() of how they
+// were built, so that a candidate is known to be a duplicate before it is
+// allocated. Open addressing, since there is one entry per expression of
+// the subset.
+class ExprIndex {
+public:
+    ExprIndex() : size_(0) { }
+    
+    // whether same(expr) holds for an expression with the hash
+    template<typename Same>
+    bool find(uint64_t hash, const Same& same) const {
+        if (slots_.empty()) return false;
+        const size_t mask=slots_.size()-1;
+        for (size_t i=slot(hash, mask); slots_[i].expr; i=(i+1) & mask) {
+            if (slots_[i].hash == hash && same(slots_[i].expr)) return true;
+        }
+        return false;
+    }
+    
+    void insert(uint64_t hash, const Expr* expr) {
+        if (2*(size_+1) > slots_.size()) grow();
+        put({hash, expr});
+        ++size_;
+    }
+    
+private:
+    struct Slot {
+        uint64_t hash;
+        const Expr* expr; // nullptr for an empty slot
+    };
+    
+    std::vector<Slot> slots_; // a power of 2 of them
+    size_t size_;
+    
+    // the member hashes are multiples of 16 (aligned addresses times odd
+    // constants), so the low bits come from the high ones
+    static size_t slot(uint64_t hash, size_t mask) {
+        return (size_t)(hash ^ (hash >> 31)) & mask;
+    }
+    
+    void put(const Slot& entry) {
+        const size_t mask=slots_.size()-1;
+        size_t i=slot(entry.hash, mask);
+        while (slots_[i].expr) i=(i+1) & mask;
+        slots_[i]=entry;
+    }
+    
+    void grow() {
+        std::vector<Slot> old(std::max<size_t>(64, slots_.size()*2),
+                              Slot{0, nullptr});
+        old.swap(slots_);
+        for (auto& entry : old) {
+            if (entry.expr) put(entry);
+        }
+    }
+};
+
+// The canonical forms counted instead of built (see setCountOnly()), by
+// the addresses of their members as in ExprIndex, in flat arrays: a few
+// dozen bytes per form, where the expressions take a few hundred.
+class FormSet {
+public:
+    size_t size() const { return forms_.size(); }
+    
+    // Adds the form of type with the members pos and neg (in address order,
+    // but base and exponent for POWER). Returns false if it is there
+    // already.
+    bool insert(uint64_t hash, ExprType type, const MemberVec& pos,
+                const MemberVec& neg)
+    {
+        if (2*(forms_.size()+1) > slots_.size()) grow();
+        const size_t mask=slots_.size()-1;
+        size_t i=(size_t)(hash ^ (hash >> 31)) & mask;
+        for (; slots_[i]; i=(i+1) & mask) {
+            const Form& form=forms_[slots_[i]-1];
+            if (form.hash == hash && same(form, type, pos, neg)) return false;
+        }
+        slots_[i]=(uint32_t)forms_.size()+1;
+        forms_.push_back({hash, (uint32_t)members_.size(), (uint8_t)type,
+            (uint8_t)pos.size(), (uint8_t)neg.size()});
+        members_.insert(members_.end(), pos.begin(), pos.end());
+        members_.insert(members_.end(), neg.begin(), neg.end());
+        return true;
+    }
+    
+private:
+    struct Form {
+        uint64_t hash;
+        uint32_t begin; // in members_, pos then neg
+        uint8_t type;
+        uint8_t pos;
+        uint8_t neg;
+    };
+    
+    std::vector<Form> forms_;
+    std::vector<const Expr*> members_;
+    std::vector<uint32_t> slots_; // 1 + index in forms_, 0 for none
+    
+    bool same(const Form& form, ExprType type, const MemberVec& pos,
+              const MemberVec& neg) const
+    {
+        if (form.type != (uint8_t)type || form.pos != pos.size() ||
+            form.neg != neg.size()) {
+            return false;
+        }
+        const Expr* const* members=&members_[form.begin];
+        return std::equal(pos.begin(), pos.end(), members) &&
+        std::equal(neg.begin(), neg.end(), members+form.pos);
+    }
+    
+    void grow() {
+        std::vector<uint32_t> slots(std::max<size_t>(64, slots_.size()*2), 0);
+        const size_t mask=slots.size()-1;
+        for (uint32_t f=0; f<forms_.size(); ++f) {
+            const uint64_t hash=forms_[f].hash;
+            size_t i=(size_t)(hash ^ (hash >> 31)) & mask;
+            while (slots[i]) i=(i+1) & mask;
+            slots[i]=f+1;
+        }
+        slots_.swap(slots);
+    }
+};
+
+template<typename Int>
+template<typename Ops>
+class BasicFind24<Int>::ValueBuilder {
 public:
     ValueBuilder(const NumVec& key, ValExprMap& value,
                  const SolutionMap& solution,
-                 const ValSet* constraint, Counters& counters)
-    : key_(key), value_(value), solution_(solution), constraint_(constraint), counters_(counters) { }
+                 const ValSet* constraint, const SearchLimits& limits,
+                 Counters& counters, StopCond& stop)
+    : key_(key), value_(value), solution_(solution), constraint_(constraint),
+    limits_(limits), counters_(counters), stop_(stop), shard_(0), shards_(1),
+    ranker_(nullptr), forms_(nullptr) { }
+    
+    // only build the expressions that belong to the given shard
+    void setShard(int shard, int shards) {
+        shard_=shard;
+        shards_=shards;
+    }
+    
+    // only keep the best k of each value (see Find24Base::setTopK()), one
+    // expression at a time
+    void setRanker(Ranker* ranker) { ranker_=ranker; }
+    
+    // only count the expressions into forms, and build none (see
+    // Find24Base::setCountOnly())
+    void setCounting(FormSet* forms) { forms_=forms; }
     
     // find all possible values for the set of literals in key_ in the form of
     // sum = x op y, where x and y are expressions built up by s1 and s2.
     void operator() (int* sel, int k) {
+        if (stop_.stopped()) return;
         NumVec s1, s2;
         splitVec(key_, sel, k, s1, s2);
         const ValExprMap& s1_vals=solution_.at(s1);
         const ValExprMap& s2_vals=solution_.at(s2);
         // neither s1_vals nor s2_vals should be empty
-        for (auto& i : s1_vals) {
-            for (auto& j : s2_vals) {
-                ++counters_.valcombos;
-                doPlus(i, j);
-                doMinus(i, j);
-                doMinus(j, i);
-                doMultiple(i, j);
-                doDivision(i, j);
-                doDivision(j, i);
+        if (joinable(s1_vals, s2_vals)) {
+            join(s1_vals, s2_vals);
+        } else {
+            for (auto& i : s1_vals) {
+                for (auto& j : s2_vals) {
+                    ++counters_.valcombos;
+                    Pair pair={*this, i, j};
+                    Ops::each(pair, limits_.ops);
+                }
             }
         }
         ++counters_.combos;
     }
     
 private:
+    typedef typename ValExprMap::value_type Values;
+    
+    // applies each operator of Ops to a pair of values
+    struct Pair {
+        ValueBuilder& vb;
+        const Values& left;
+        const Values& right;
+        
+        template<typename Operator> void apply() {
+            vb.template doOp<Operator>(left, right);
+            if (!Operator::commutative) vb.template doOp<Operator>(right, left);
+        }
+    };
+    
+    // calls doOp() for x and the value of other it is looked up in
+    template<typename Operator>
+    struct Probe {
+        ValueBuilder& vb;
+        const Values& x;
+        const ValExprMap& other;
+        bool left; // x is the left operand
+        
+        void operator() (const Rational& y) {
+            auto it=other.find(y);
+            if (it == other.end()) return;
+            ++vb.counters_.valcombos;
+            if (left) {
+                vb.template doOp<Operator>(x, *it);
+            } else {
+                vb.template doOp<Operator>(*it, x);
+            }
+        }
+    };
+    
+    // for a value x of one side, looks up the values of the other side that
+    // give an allowed value with each operator of Ops, in the same order of
+    // operands as Pair
+    struct Join {
+        ValueBuilder& vb;
+        const Values& x;
+        const ValExprMap& other;
+        bool s1; // x is from s1
+        
+        template<typename Operator> void apply() {
+            for (auto& sum : *vb.constraint_) {
+                if (!Operator::commutative || s1) {
+                    Probe<Operator> probe={vb, x, other, true};
+                    Operator::solveRight(sum, x.first, vb.limits_, probe);
+                }
+                if (!Operator::commutative || !s1) {
+                    Probe<Operator> probe={vb, x, other, false};
+                    Operator::solveLeft(sum, x.first, vb.limits_, probe);
+                }
+            }
+        }
+    };
+    
     const NumVec& key_;
     ValExprMap& value_;
     const SolutionMap& solution_;
     const ValSet* constraint_;
+    const SearchLimits& limits_;
     Counters& counters_;
+    StopCond& stop_;
+    int shard_;
+    int shards_;
+    Ranker* ranker_;
+    FormSet* forms_;
+    ExprIndex index_; // of everything built into value_, without a ranker
+    std::vector<Expr*> batch_;
+    MemberVec pos_, neg_, epos_, eneg_; // for sameAs()
     
-    void doPlus(const ValExprMap::value_type& left,
-                const ValExprMap::value_type& right)
+    // With fewer allowed values than one side has values (the root only
+    // allows the target), each value of the smaller side and each allowed
+    // value fix the value the other side needs for each operator, which is
+    // looked up instead of trying every pair. 0 is left to the full scan,
+    // since e.g. 0*x = 0 for every x.
+    bool joinable(const ValExprMap& s1_vals, const ValExprMap& s2_vals) const
     {
-        Rational result=left.first + right.first;
-        if (constraint_ && !constraint_->count(result)) {
-            return;
+        return constraint_ && !constraint_->count(Rational(0)) &&
+        constraint_->size() < std::max(s1_vals.size(), s2_vals.size());
+    }
+    
+    void join(const ValExprMap& s1_vals, const ValExprMap& s2_vals) {
+        const bool from_s1=(s1_vals.size() <= s2_vals.size());
+        const ValExprMap& scan=(from_s1 ? s1_vals : s2_vals);
+        const ValExprMap& other=(from_s1 ? s2_vals : s1_vals);
+        for (auto& x : scan) {
+            Join join={*this, x, other, from_s1};
+            Ops::each(join, limits_.ops);
         }
-        auto it = value_.find(result);
-        if (it == value_.end()) {
-            ++counters_.newvalues;
-            it=value_.insert({result, {}}).first;
+    }
+    
+    bool inShard(const Expr* left, const Expr* right, ExprType type,
+                 bool inverse) const
+    {
+        return shards_ == 1 ||
+        shardOf(left, right, type, inverse, shards_) == shard_;
+    }
+    
+    // whether expr is left op right, going by their members
+    bool sameAs(const Expr* expr, const Expr* left, const Expr* right,
+                ExprType type, bool inverse)
+    {
+        if (expr->getType() != type) return false;
+        if (type == ExprType::POWER) {
+            const Power* power=static_cast<const Power*>(expr);
+            return power->getBase() == left && power->getExponent() == right;
         }
-        ExprSet& exprs=it->second;
-        for (auto& lexpr : left.second) {
-            for (auto& rexpr : right.second) {
-                ++counters_.exprcombos;
-                std::unique_ptr<Expr> expr(new AddSub(lexpr, rexpr, false));
-                if (!exprs.count(expr.get())) {
-                    ++counters_.uniqexprs;
-                    exprs.insert(expr.release());
-                }
-            }
+        pos_.clear();
+        neg_.clear();
+        addMembers(left, type, pos_, neg_);
+        addMembers(right, type, inverse ? neg_ : pos_, inverse ? pos_ : neg_);
+        epos_.clear();
+        eneg_.clear();
+        addMembers(expr, type, epos_, eneg_);
+        if (pos_.size() != epos_.size() || neg_.size() != eneg_.size()) {
+            return false;
         }
+        std::sort(pos_.begin(), pos_.end());
+        std::sort(neg_.begin(), neg_.end());
+        std::sort(epos_.begin(), epos_.end());
+        std::sort(eneg_.begin(), eneg_.end());
+        return pos_ == epos_ && neg_ == eneg_;
     }
     
-    void doMinus(const ValExprMap::value_type& left,
-                 const ValExprMap::value_type& right)
-    {
-        Rational result=left.first - right.first;
-        if (result < Rational(0)) return;
-        
-        if (constraint_ && !constraint_->count(result)) {
+    // Builds lexpr op rexpr into batch_ unless it has been built already.
+    // Duplicates are found by their members in index_, so they are never
+    // allocated.
+    template<typename Operator>
+    void batchExpr(const Expr* lexpr, const Expr* rexpr) {
+        const uint64_t hash=hashCombined(lexpr, rexpr, Operator::type,
+                                         Operator::inverse);
+        auto same=[&](const Expr* expr) {
+            return sameAs(expr, lexpr, rexpr, Operator::type,
+                          Operator::inverse);
+        };
+        if (index_.find(hash, same)) {
+            ++counters_.dups[(int)Operator::code];
             return;
         }
         
-        auto it = value_.find(result);
-        if (it == value_.end()) {
-            ++counters_.newvalues;
-            it=value_.insert({result, {}}).first;
+        Expr* expr=Operator::make(lexpr, rexpr);
+        index_.insert(hash, expr);
+        batch_.push_back(expr);
+        ++counters_.uniqexprs;
+    }
+    
+    // Counts lexpr op rexpr into forms_ instead, with the same members
+    // sameAs() would compare.
+    template<typename Operator>
+    void countExpr(const Expr* lexpr, const Expr* rexpr) {
+        const ExprType type=Operator::type;
+        pos_.clear();
+        neg_.clear();
+        addMembers(lexpr, type, pos_, neg_);
+        addMembers(rexpr, type, Operator::inverse ? neg_ : pos_,
+                   Operator::inverse ? pos_ : neg_);
+        if (type != ExprType::POWER) {
+            std::sort(pos_.begin(), pos_.end());
+            std::sort(neg_.begin(), neg_.end());
         }
-        ExprSet& exprs=it->second;
-        bool checkZero = result==Rational(0);
-        for (auto& lexpr : left.second) {
-            for (auto& rexpr : right.second) {
-                ++counters_.exprcombos;
-                if (checkZero && cmpExpr(lexpr, rexpr)>0) continue;
-                std::unique_ptr<Expr> expr(new AddSub(lexpr, rexpr, true));
-                if (!exprs.count(expr.get())) {
-                    ++counters_.uniqexprs;
-                    exprs.insert(expr.release());
-                }
+        const uint64_t hash=hashCombined(lexpr, rexpr, type,
+                                         Operator::inverse);
+        if (!forms_->insert(hash, type, pos_, neg_)) {
+            ++counters_.dups[(int)Operator::code];
+            return;
+        }
+        ++counters_.uniqexprs;
+    }
+    
+    // Adds the expressions batched by one doOp() to exprs, which has none
+    // of them. Sorted, they go in with one pass over exprs, unless there
+    // are so few that looking up each is cheaper.
+    void mergeBatch(ExprSet& exprs) {
+        if (batch_.size()*16 < exprs.size()) {
+            for (auto& expr : batch_) exprs.insert(expr);
+        } else {
+            std::sort(batch_.begin(), batch_.end(), ExprCmp());
+            auto it=exprs.begin();
+            for (auto& expr : batch_) {
+                while (it != exprs.end() && cmpExpr(*it, expr) < 0) ++it;
+                it=std::next(exprs.insert(it, expr));
             }
         }
+        batch_.clear();
     }
     
-    void doMultiple(const ValExprMap::value_type& left,
-                    const ValExprMap::value_type& right)
+    // adds lexpr op rexpr to exprs unless it is there already, or, for the
+    // root when ranking, it cannot make the top k
+    template<typename Operator>
+    void addExpr(ExprSet& exprs, const Expr* lexpr, const Expr* rexpr,
+                 const Rational& result)
     {
-        Rational result=left.first * right.first;
-        if (constraint_ && !constraint_->count(result)) {
+        if (forms_) {
+            countExpr<Operator>(lexpr, rexpr);
             return;
         }
-        
-        auto it = value_.find(result);
-        if (it == value_.end()) {
-            ++counters_.newvalues;
-            it=value_.insert({result, {}}).first;
+        // the ranker may drop expressions again, so it takes them one at
+        // a time
+        if (!ranker_) {
+            batchExpr<Operator>(lexpr, rexpr);
+            return;
         }
-        ExprSet& exprs=it->second;
-        for (auto& lexpr : left.second) {
-            for (auto& rexpr : right.second) {
-                ++counters_.exprcombos;
-                std::unique_ptr<Expr> expr(new MulDiv(lexpr, rexpr, false));
-                if (!exprs.count(expr.get())) {
-                    ++counters_.uniqexprs;
-                    exprs.insert(expr.release());
-                }
-            }
+        
+        ExprFeatures features=ranker_->combine(lexpr, rexpr, Operator::code,
+                                               result.divisor() != 1);
+        const double cost=ranker_->cost(features);
+        if (!ranker_->beats(exprs, cost, nullptr)) return;
+        
+        std::unique_ptr<Expr> expr(Operator::make(lexpr, rexpr));
+        if (exprs.count(expr.get())) {
+            ++counters_.dups[(int)Operator::code];
+            return;
         }
+        if (!ranker_->beats(exprs, cost, expr.get())) return;
+        
+        ++counters_.uniqexprs;
+        ranker_->insert(exprs, expr, features, cost);
     }
     
-    void doDivision(const ValExprMap::value_type& left,
-                    const ValExprMap::value_type& right)
+    template<typename Operator>
+    void doOp(const Values& left, const Values& right)
     {
-        if (right.first == Rational(0)) return;
-        Rational result=left.first / right.first;
+        Rational result(0);
+        if (!Operator::apply(left.first, right.first, limits_, result)) return;
+        if (!limits_.admits(result)) return;
         if (constraint_ && !constraint_->count(result)) {
             return;
         }
@@ -221,27 +1020,29 @@ private:
             it=value_.insert({result, {}}).first;
         }
         ExprSet& exprs=it->second;
-        bool checkOne=result==Rational(1);
+        // e.g. a-b=0 and b-a=0 are the same, keep only one of them
+        bool tie=!Operator::commutative && left.first == right.first;
         for (auto& lexpr : left.second) {
             for (auto& rexpr : right.second) {
+                if (!inShard(lexpr, rexpr, Operator::type, Operator::inverse)) continue;
                 ++counters_.exprcombos;
-                if (checkOne && cmpExpr(lexpr, rexpr)>0) continue;
-                std::unique_ptr<Expr> expr(new MulDiv(lexpr, rexpr, true));
-                if (!exprs.count(expr.get())) {
-                    ++counters_.uniqexprs;
-                    exprs.insert(expr.release());
-                }
+                if (tie && cmpExpr(lexpr, rexpr)>0) continue;
+                addExpr<Operator>(exprs, lexpr, rexpr, result);
             }
         }
+        if (!batch_.empty()) mergeBatch(exprs);
     }
 };
 
-class Find24::SolutionBuilder {
+template<typename Int>
+template<typename Ops>
+class BasicFind24<Int>::SolutionBuilder {
 public:
-    SolutionBuilder(Find24& parent, bool check_constraint) :
+    SolutionBuilder(BasicFind24& parent, bool check_constraint) :
     p_(parent), check_constraint_(check_constraint) { }
     
     void operator() (int* sel, int k) {
+        if (p_.stop_.stopped()) return;
         NumVec key;
         for (int i=0; i<k; ++i) {
             key.push_back(p_.elems_[sel[i]]);
@@ -249,34 +1050,51 @@ public:
         if (!p_.solution_.count(key)) {
             ValExprMap value;
             ValSet* constraint=(check_constraint_)?&(p_.constraint_.at(key)):nullptr;
-            ValueBuilder vb(key, value, p_.solution_, constraint, p_.counters_);
+            const bool root=(key.size() == p_.elems_.size());
+            const SearchLimits root_limits=p_.limits_.atRoot(p_.target_);
+            ValueBuilder<Ops> vb(key, value, p_.solution_, constraint,
+                                 root ? root_limits : p_.limits_,
+                                 p_.counters_, p_.stop_);
+            FormSet forms;
+            if (root && p_.count_only_) {
+                vb.setCounting(&forms);
+            } else if (root) {
+                vb.setRanker(p_.ranker_.get());
+            }
             for (int i=1; i<=key.size()/2; ++i) {
                 selectK((int)key.size(), i, vb);
             }
+            if (root && p_.count_only_) p_.count_=forms.size();
+            // inserted even if incomplete, so that freeSolutionMap() owns it
             p_.solution_.insert({key, value});
             ++p_.counters_.subsets;
         }
+        p_.subsetDone();
     }
     
 private:
-    Find24& p_;
+    BasicFind24& p_;
     bool check_constraint_;
 };
 
-class Find24::CVBuilder {
+template<typename Int>
+template<typename Ops>
+class BasicFind24<Int>::CVBuilder {
 public:
     CVBuilder(const NumVec& ckey, const NumVec& eelems, ValSet& value,
               const ConstraintMap& constraint, const SolutionMap& solution,
-              Counters& counters) :
+              const SearchLimits& limits, Counters& counters, StopCond& stop) :
     ckey_(ckey), eelems_(eelems), value_(value), constraint_(constraint),
-    solution_(solution), counters_(counters) { }
+    solution_(solution), limits_(limits), counters_(counters), stop_(stop) { }
     
     // find all possible values of ckey_ based on constraints. Given the
     // following two formulae  (sum = ckey op other) and
     // (sum = other op ckey), and that we know all possible values of sum and
-    // other, deduce the possible values of ckey.
+    // other, deduce the possible values of ckey. Only the operators of Ops
+    // are inverted, and values ckey may not have are dropped.
     // Input is the subset of elements representing other.
     void operator() (int* sel, int k) {
+        if (stop_.stopped()) return;
         NumVec sum, other;
         for (int i=0; i<k; ++i) {
             other.push_back(eelems_[sel[i]]);
@@ -307,12 +1125,8 @@ public:
         for (auto& i : sum_constraint) {
             for (auto& j : other_values) {
                 ++counters_.cvalcombos;
-                doMinus(i, j.first); // i = x + j
-                doPlus(i, j.first); // i = x - j
-                doMinus(j.first, i); // i = j - x
-                doDivision(i, j.first); // i = x*j
-                doMultiple(i, j.first); // i = x/j
-                doDivision(j.first, i); // i = j/x
+                Pair pair={*this, i, j.first};
+                Ops::each(pair, limits_.ops);
             }
         }
         ++counters_.ccombos;
@@ -324,74 +1138,412 @@ private:
     ValSet& value_;
     const ConstraintMap& constraint_;
     const SolutionMap& solution_;
+    const SearchLimits& limits_;
     Counters& counters_;
+    StopCond& stop_;
     
-    void doPlus(const Rational& left, const Rational& right)
-    {
-        value_.insert(left + right);
-    }
-    
-    void doMinus(const Rational& left, const Rational& right)
-    {
-        if (left < right) return;
-        value_.insert(left - right);
-    }
-    
-    void doMultiple(const Rational& left, const Rational& right)
-    {
-        value_.insert(left * right);
-    }
+    // the values of ckey for one operator of Ops
+    struct Pair {
+        CVBuilder& cvb;
+        const Rational& sum;
+        const Rational& other;
+        
+        template<typename Operator> void apply() {
+            solveOp<Operator>(sum, other, cvb.limits_, *this);
+        }
+        
+        // called by the operator with each value deduced
+        void operator() (const Rational& value) { cvb.insert(value); }
+    };
     
-    void doDivision(const Rational& left, const Rational& right)
+    void insert(const Rational& value)
     {
-        if (right == 0) return;
-        value_.insert(left / right);
+        if (limits_.admits(value)) value_.insert(value);
     }
 };
 
-class Find24::ConstraintBuilder {
+template<typename Int>
+template<typename Ops>
+class BasicFind24<Int>::ConstraintBuilder {
 public:
-    ConstraintBuilder(Find24& p) : p_(p) {}
+    ConstraintBuilder(BasicFind24& p) : p_(p) {}
     void operator () (int* sel, int k) {
+        if (p_.stop_.stopped()) return;
         NumVec ckey; // key to the constraint map
         NumVec eelems; // expanding elems
         splitVec(p_.elems_, sel, k, eelems, ckey);
         if (!p_.constraint_.count(ckey)) { // in case we have duplicate values in elems
             ValSet value;
-            CVBuilder cvb(ckey, eelems, value, p_.constraint_, p_.solution_,
-                          p_.counters_);
+            CVBuilder<Ops> cvb(ckey, eelems, value, p_.constraint_,
+                               p_.solution_, p_.limits_, p_.counters_,
+                               p_.stop_);
             for (int i=1; i<=(int)eelems.size(); ++i) {
                 selectK((int)eelems.size(), i, cvb);
             }
             p_.constraint_.insert({ckey, value});
             ++p_.counters_.csubsets;
         }
+        p_.subsetDone();
     }
     
 private:
-    Find24& p_;
+    BasicFind24& p_;
+};
+
+// runs buildLayers() for the operator set of the limits
+template<typename Int>
+class BasicFind24<Int>::LayerBuilder {
+public:
+    LayerBuilder(BasicFind24& p) : p_(p) {}
+    template<typename Ops> void run() { p_.template buildLayers<Ops>(); }
+    
+private:
+    BasicFind24& p_;
 };
 
-void Find24::buildSolutionMap() {
+template<typename Int>
+void BasicFind24<Int>::buildSolutionMap() {
+    if (usesCheckpoint()) {
+        loadCheckpoint();
+        last_checkpoint_=Clock::now();
+        checkpoint_cost_=Clock::duration::zero();
+        checkpoint_subsets_=counters_.subsets+counters_.csubsets;
+    }
+    LayerBuilder lb(*this);
+    dispatchOpSet(limits_.ops, lb);
+}
+
+template<typename Int>
+template<typename Ops>
+void BasicFind24<Int>::buildLayers() {
+    const int n=(int)elems_.size();
+    startProgress();
     addLiterals();
-    SolutionBuilder sb(*this, false);
-    for (int i=2; i<=elems_.size()/2; ++i) {
-        selectK((int)elems_.size(), i, sb);
+    SolutionBuilder<Ops> sb(*this, false);
+    for (int i=2; i<=n/2; ++i) {
+        Phase phase(*this, "values", i);
+        selectK(n, i, sb);
+        checkpoint();
     }
     
     addRootConstraint();
-    ConstraintBuilder cb(*this);
-    for (int i=1; i<=(elems_.size()-1)/2; ++i) {
-        selectK((int)elems_.size(), i, cb);
+    ConstraintBuilder<Ops> cb(*this);
+    for (int i=1; i<=(n-1)/2; ++i) {
+        Phase phase(*this, "constraints", n-i);
+        selectK(n, i, cb);
+        checkpoint();
+    }
+    
+    SolutionBuilder<Ops> sb2(*this, true);
+    for (int i=n/2+1; i<n; ++i) {
+        Phase phase(*this, "constrained", i);
+        selectK(n, i, sb2);
+        checkpoint();
+    }
+    
+    Phase phase(*this, "root", n);
+    if (ranker_) addFeatures();
+    if (workers_ > 1 && n > 1 && !ranker_) {
+        buildRootSharded<Ops>();
+    } else {
+        selectK(n, n, sb2);
+    }
+    
+    // a single number is its own root, counted or not
+    if (count_only_ && n > 1) return;
+    const ExprSet* exprs=getExprSet();
+    count_=(exprs ? exprs->size() : 0);
+    if (exprs && ranker_) ranked_=ranker_->rank(*exprs);
+}
+
+// What a worker of buildRootSharded() built: the root expressions of its
+// shard, or with setCountOnly() only their number in counters.uniqexprs.
+template<typename Int>
+struct BasicFind24<Int>::Shard {
+    ValExprMap value;
+    Counters counters;
+    StopCond stop;
+};
+
+// Every worker goes through all the splits of the root, but only builds the
+// expressions of its own shard, so the workers' results do not overlap.
+// The lower layers are only read, so the workers share them as they are,
+// each with counters and a stop condition of its own.
+template<typename Int>
+template<typename Ops>
+void BasicFind24<Int>::runShard(int worker, Shard& shard) {
+    const SearchLimits root_limits=limits_.atRoot(target_);
+    const ValSet& constraint=constraint_.at(elems_);
+    ValueBuilder<Ops> vb(elems_, shard.value, solution_, &constraint,
+                         root_limits, shard.counters, shard.stop);
+    vb.setShard(worker, workers_);
+    FormSet forms;
+    if (count_only_) vb.setCounting(&forms);
+    for (int i=1; i<=(int)elems_.size()/2; ++i) {
+        selectK((int)elems_.size(), i, vb);
+    }
+}
+
+template<typename Int>
+template<typename Ops>
+void BasicFind24<Int>::buildRootSharded() {
+    if (stop_.stopped()) return;
+    
+    // shard 0 is built on this thread, and so is any shard a thread cannot
+    // be started for
+    std::vector<Shard> shards(workers_);
+    for (auto& shard : shards) shard.stop=stop_;
+    std::vector<std::thread> threads;
+    for (int w=1; w<workers_; ++w) {
+        try {
+            threads.emplace_back([this, w, &shards]() {
+                this->template runShard<Ops>(w, shards[w]);
+            });
+        } catch (const std::system_error&) {
+            std::cerr << "Failed to start workers, running in-process" <<
+            std::endl;
+            break;
+        }
+    }
+    runShard<Ops>(0, shards[0]);
+    for (int w=(int)threads.size()+1; w<workers_; ++w) {
+        runShard<Ops>(w, shards[w]);
+    }
+    for (auto& thread : threads) thread.join();
+    
+    std::vector<ExprSet*> sets;
+    for (int w=0; w<workers_; ++w) {
+        Shard& shard=shards[w];
+        const Counters& counters=shard.counters;
+        if (shard.stop.status != Status::OK) stop_.status=shard.stop.status;
+        
+        // all workers see every value combination, but each builds only
+        // its own expressions
+        if (w == 0) {
+            counters_.combos+=counters.combos;
+            counters_.valcombos+=counters.valcombos;
+        }
+        counters_.exprcombos+=counters.exprcombos;
+        counters_.uniqexprs+=counters.uniqexprs;
+        for (int op=0; op<5; ++op) counters_.dups[op]+=counters.dups[op];
+        // the shards are disjoint, and only the root counts
+        if (count_only_) count_+=counters.uniqexprs;
+        
+        // the root only allows the target
+        auto it=shard.value.find(Rational(target_));
+        if (it != shard.value.end()) sets.push_back(&it->second);
+    }
+    
+    // The shards are disjoint, so a k-way merge gives the same ExprSet a
+    // single thread builds, and every insert is at the end. Even a search
+    // that was stopped keeps what it built, so that freeSolutionMap() owns
+    // it.
+    ValExprMap value;
+    std::vector<ExprSet::iterator> pos;
+    for (auto set : sets) pos.push_back(set->begin());
+    ExprSet* exprs=nullptr;
+    while (true) {
+        int next=-1;
+        for (int w=0; w<(int)sets.size(); ++w) {
+            if (pos[w] == sets[w]->end()) continue;
+            if (next < 0 || cmpExpr(*pos[w], *pos[next]) < 0) next=w;
+        }
+        if (next < 0) break;
+        if (!exprs) {
+            ++counters_.newvalues;
+            exprs=&value.insert({target_, {}}).first->second;
+        }
+        exprs->insert(exprs->end(), *pos[next]++);
+    }
+    solution_.insert({elems_, value});
+    ++counters_.subsets;
+}
+
+template<typename Int>
+bool BasicFind24<Int>::usesCheckpoint() const {
+    return !checkpoint_path_.empty() && !ranker_;
+}
+
+// After a layer, which must have run to completion, unless it added
+// nothing (e.g. it was in the snapshot resumed from). Each snapshot has all
+// the layers so far, so they are also spaced out to at least 10 times the
+// time the last one took, which keeps them to a tenth of the time.
+template<typename Int>
+void BasicFind24<Int>::checkpoint() {
+    if (!usesCheckpoint() || stop_.status != Status::OK) return;
+    const int subsets=counters_.subsets+counters_.csubsets;
+    if (subsets == checkpoint_subsets_) return;
+    const Clock::time_point start=Clock::now();
+    if (start-last_checkpoint_ < std::max(checkpoint_interval_,
+                                          10*checkpoint_cost_)) {
+        return;
+    }
+    if (!saveCheckpoint()) {
+        std::cerr << "Oops, cannot write checkpoint " << checkpoint_path_ <<
+        std::endl;
+    }
+    last_checkpoint_=Clock::now();
+    checkpoint_cost_=last_checkpoint_-start;
+    checkpoint_subsets_=subsets;
+}
+
+template<typename Int>
+static CheckpointHeader checkpointHeader(int target,
+                                         const SearchLimits& limits)
+{
+    CheckpointHeader ret;
+    memset(&ret, 0, sizeof(ret));
+    ret.target=target;
+    ret.int_size=sizeof(Int);
+    ret.ops=limits.ops;
+    ret.max_dividend=limits.max_dividend;
+    ret.max_divisor=limits.max_divisor;
+    ret.integer_only=limits.integer_only;
+    return ret;
+}
+
+template<typename Int>
+bool BasicFind24<Int>::saveCheckpoint() const {
+    CheckpointWriter out(checkpointHeader<Int>(target_, limits_), elems_);
+    
+    // smaller subsets first, so members come before what is made of them
+    std::vector<const typename SolutionMap::value_type*> subsets;
+    for (auto& x : solution_) subsets.push_back(&x);
+    std::stable_sort(subsets.begin(), subsets.end(),
+                     [](const typename SolutionMap::value_type* a,
+                        const typename SolutionMap::value_type* b) {
+        return a->first.size() < b->first.size();
+    });
+    
+    size_t count=0;
+    for (auto x : subsets) {
+        for (auto& y : x->second) count+=y.second.size();
+    }
+    out.reserve(count);
+    out.beginSection(CheckpointTag::EXPRS);
+    for (auto x : subsets) {
+        for (auto& y : x->second) {
+            for (auto& z : y.second) {
+                if (!out.putExpr(z)) return false;
+            }
+        }
+    }
+    
+    out.beginSection(CheckpointTag::VALUES);
+    for (auto x : subsets) {
+        out.put((uint32_t)x->first.size());
+        for (int elem : x->first) out.put((int32_t)elem);
+        out.put((uint32_t)x->second.size());
+        for (auto& y : x->second) {
+            out.put(y.first.dividend());
+            out.put(y.first.divisor());
+            out.put((uint32_t)y.second.size());
+            for (auto& z : y.second) out.putRef(z);
+        }
+    }
+    
+    out.beginSection(CheckpointTag::CONSTRAINTS);
+    for (auto& x : constraint_) {
+        out.put((uint32_t)x.first.size());
+        for (int elem : x.first) out.put((int32_t)elem);
+        out.put((uint32_t)x.second.size());
+        for (auto& value : x.second) {
+            out.put(value.dividend());
+            out.put(value.divisor());
+        }
+    }
+    
+    out.beginSection(CheckpointTag::COUNTERS);
+    out.put(counters_);
+    return out.write(checkpoint_path_);
+}
+
+// reads a subset and a value of a snapshot
+static bool getSubset(CheckpointReader& in, NumVec& key) {
+    uint32_t size;
+    if (!in.get(size) || size > 64) return false;
+    key.resize(size);
+    for (auto& elem : key) {
+        int32_t value;
+        if (!in.get(value)) return false;
+        elem=value;
+    }
+    return true;
+}
+
+template<typename Int>
+static bool getValue(CheckpointReader& in, BasicRational<Int>& value) {
+    Int dividend, divisor;
+    if (!in.get(dividend) || !in.get(divisor) || divisor <= 0) return false;
+    value=BasicRational<Int>(dividend, divisor);
+    return true;
+}
+
+// Fills solution_ and constraint_ from the snapshot, if there is one of
+// this search. Returns false, with nothing changed, if there is none.
+template<typename Int>
+bool BasicFind24<Int>::loadCheckpoint() {
+    CheckpointReader in;
+    if (!in.open(checkpoint_path_, checkpointHeader<Int>(target_, limits_),
+                 elems_)) {
+        return false;
+    }
+    
+    bool ok=in.section(CheckpointTag::EXPRS);
+    while (ok && !in.atEnd()) ok=in.getExpr();
+    
+    SolutionMap solution;
+    ok=ok && in.section(CheckpointTag::VALUES);
+    while (ok && !in.atEnd()) {
+        NumVec key;
+        uint32_t values=0;
+        ok=getSubset(in, key) && in.get(values);
+        ValExprMap& value=solution[key];
+        for (uint32_t i=0; ok && i<values; ++i) {
+            Rational result(0);
+            uint32_t count=0;
+            ok=getValue(in, result) && in.get(count);
+            ExprSet& exprs=value[result];
+            for (uint32_t j=0; ok && j<count; ++j) {
+                Expr* expr=nullptr;
+                ok=in.getRef(expr);
+                if (ok) exprs.insert(exprs.end(), expr);
+            }
+        }
     }
     
-    SolutionBuilder sb2(*this, true);
-    for (int i=(int)elems_.size()/2+1; i<=elems_.size(); ++i) {
-        selectK((int)elems_.size(), i, sb2);
+    ConstraintMap constraint;
+    ok=ok && in.section(CheckpointTag::CONSTRAINTS);
+    while (ok && !in.atEnd()) {
+        NumVec key;
+        uint32_t values=0;
+        ok=getSubset(in, key) && in.get(values);
+        ValSet& value=constraint[key];
+        for (uint32_t i=0; ok && i<values; ++i) {
+            Rational result(0);
+            ok=getValue(in, result);
+            if (ok) value.insert(value.end(), result);
+        }
+    }
+    
+    Counters counters;
+    ok=ok && in.section(CheckpointTag::COUNTERS) && in.get(counters);
+    if (!ok) {
+        std::cerr << "Oops, checkpoint " << checkpoint_path_ <<
+        " is damaged!" << std::endl;
+        return false;
     }
+    
+    // the reader owns the expressions until here
+    in.release();
+    solution_.swap(solution);
+    constraint_.swap(constraint);
+    counters_=counters;
+    return true;
 }
 
-void Find24::freeSolutionMap() {
+template<typename Int>
+void BasicFind24<Int>::freeSolutionMap() {
     for (auto& x : solution_) {
         for (auto& y : x.second) {
             for (auto& z : y.second) {
@@ -400,3 +1552,7 @@ void Find24::freeSolutionMap() {
         }
     }
 }
+
+template class BasicFind24<int32_t>;
+template class BasicFind24<int64_t>;
+template class BasicFind24<__int128>;
@@ -12,17 +12,263 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
 
 #include "rational.hpp"
 #include "expr.hpp"
+#include "searchlimits.hpp"
+#include "perfcounters.hpp"
+#include "exprcost.hpp"
+
+enum class OpCode : uint8_t; // see opset.hpp
 
 // elems must be sorted in ascending order, could have duplicated elems
 typedef std::vector<int> NumVec;
 typedef std::set<Expr*, ExprCmp> ExprSet;
-typedef std::map<Rational, ExprSet> ValExprMap;
-typedef std::map<NumVec, ValExprMap> SolutionMap;
-typedef std::set<Rational> ValSet;
-typedef std::map<NumVec, ValSet> ConstraintMap;
+
+// print expr as a solution for target
+void writeExpr(ExprWriter& out, const Expr* expr, int target,
+               OutputFormat format);
+
+// print every expression in exprs as a solution for target
+void writeExprSet(ExprWriter& out, const ExprSet& exprs, int target,
+                  OutputFormat format);
+
+// The integer type the value tables of a search need, see chooseIntWidth().
+enum class IntWidth { INT32, INT64, INT128 };
+
+// Any value built from a subset S, or deduced for S from the constraints, is
+// p/q with |p| and q bounded by 2^(|S|-1) times the product of the numbers
+// involved (the target counts as one for the constraints). So with n elements
+// 2^n*|target|*prod(elems) bounds every dividend and divisor, and its square
+// bounds the cross products Rational computes in its wider type. With both
+// max_dividend and max_divisor set, every value is within the limits, and
+// so 2*limit^2 bounds any result of two of them (before it is dropped). With
+// POWER only the limits bound the values (see SearchLimits::effective()).
+IntWidth chooseIntWidth(int target, const std::vector<int>& elems,
+                        const SearchLimits& limits=SearchLimits());
+
+// What a search did, mostly for debugging and tuning.
+struct Find24Counters {
+    int subsets;
+    int combos;
+    int newvalues;
+    int valcombos;
+    int exprcombos;
+    int uniqexprs;
+    int csubsets;
+    int ccombos;
+    int cvalcombos;
+    // expressions left out because they were built already, by OpCode
+    int dups[5];
+    Find24Counters() : subsets(0), combos(0), newvalues(0), valcombos(0),
+    exprcombos(0), uniqexprs(0), csubsets(0), ccombos(0), cvalcombos(0),
+    dups() { }
+    
+    int totalDups() const {
+        int ret=0;
+        for (int dup : dups) ret+=dup;
+        return ret;
+    }
+};
+
+// Where a search is, handed to the callback of Find24Base::setProgress().
+// The phases are the rows of the FIND24_PROFILE table. Each goes through
+// the C(n, k) ways to pick k of the n numbers once, so the totals are known
+// up front; picks that give numbers seen before are done at once.
+struct Find24Progress {
+    const char* phase; // "values", "constraints", "constrained" or "root"
+    int size; // of the subsets of the phase
+    int done; // subsets of the phase
+    int total;
+    int done_all; // subsets of every phase
+    int total_all;
+    int values; // built so far (Find24Counters::newvalues)
+    int exprs; // built so far (Find24Counters::uniqexprs)
+    double seconds; // since run() started
+    double eta; // seconds left in the phase at its rate so far, -1 if unknown
+};
+
+// Everything about a search that does not depend on the integer width.
+class Find24Base {
+public:
+    typedef std::chrono::steady_clock Clock;
+    
+    // OK means the search ran to completion; otherwise it was stopped early
+    // and only the counters are meaningful.
+    enum class Status { OK, TIMEOUT, CANCELLED };
+    
+    // Both are checked cooperatively before each subset and each split, so
+    // run() returns within the time of a single split after either fires.
+    void setDeadline(Clock::time_point deadline) {
+        stop_.has_deadline = true;
+        stop_.deadline = deadline;
+    }
+    
+    void setTimeout(Clock::duration timeout) {
+        setDeadline(Clock::now() + timeout);
+    }
+    
+    // token is borrowed and must outlive run(); set it to true to cancel.
+    void setCancelToken(const std::atomic<bool>* token) {
+        stop_.cancel = token;
+    }
+    
+    // Split the last (root) layer across this many worker threads, run()
+    // itself being one of them. The lower layers are built once and shared
+    // read-only with the workers. The results are the same as with a single
+    // thread.
+    void setWorkers(int workers) { workers_ = workers; }
+    
+    // applied to every value built, including those for the constraints,
+    // but not to the target itself (see SearchLimits::atRoot()); with
+    // POWER, values are capped as well (see SearchLimits::effective())
+    void setLimits(const SearchLimits& limits) {
+        limits_ = limits.effective();
+    }
+    
+    // Break the debugging statistics down by phase of the search (each
+    // layer of values, of constraints and the root), with the wall time and
+    // the hardware counters of each, where the machine lets us read them.
+    // Work done by the other worker threads is not included.
+    void setProfile(bool profile) { profile_ = profile; }
+    
+    typedef std::function<void(const Find24Progress&)> ProgressCallback;
+    
+    // Called from run() when each phase starts and ends, and after each
+    // subset in between, so it should be quick. The root is a single subset,
+    // and the worker threads do not report.
+    void setProgress(const ProgressCallback& progress) {
+        progress_ = progress;
+    }
+    
+    // Save the finished layers of values and constraints to path (see
+    // checkpoint.hpp) at the end of a layer, at most once per interval (and
+    // seldom enough to keep the cost down), and start from what is there
+    // if path holds a snapshot of the same search. Anything else at path
+    // (another search, a damaged file) is left alone until it is replaced.
+    // Not with setTopK(), whose features are not saved.
+    void setCheckpoint(const std::string& path,
+                       Clock::duration interval=Clock::duration::zero()) {
+        checkpoint_path_ = path;
+        checkpoint_interval_ = interval;
+    }
+    
+    // Keep only the k solutions of the lowest cost instead of all of them.
+    // The layers below the root are built as usual and their features
+    // worked out once they are done; those of a solution come from its two
+    // halves as it is built, and one that cannot beat the k-th best so far
+    // is not even allocated. The root runs in a single thread.
+    void setTopK(int k, const CostFunction& cost=defaultCost);
+    
+    // Only count the solutions instead of building them. Each solution the
+    // root would build is told apart from the others by the addresses of
+    // its members, as duplicates are, so the count is exactly
+    // getExprs().size() of a full run without the memory of the
+    // expressions; getExprs() is empty. The layers below the root are built
+    // as usual, they are the members. Takes the place of setTopK().
+    void setCountOnly(bool count_only) { count_only_ = count_only; }
+    
+    // the number of solutions (kept, with setTopK()), 0 unless run()
+    // returned Status::OK
+    uint64_t getCount() const {
+        return stop_.status == Status::OK ? count_ : 0;
+    }
+    
+    Status getStatus() const { return stop_.status; }
+    
+    const Find24Counters& getCounters() const { return counters_; }
+    
+    int getTarget() const { return target_; }
+    
+    // the solutions kept with setTopK(), cheapest first and ties in ExprSet
+    // order; empty otherwise
+    const std::vector<const Expr*>& getRanked() const { return ranked_; }
+    
+protected:
+    Find24Base(int target, const std::vector<int>& elems);
+    ~Find24Base();
+    
+    int target_;
+    NumVec elems_;
+    int workers_;
+    SearchLimits limits_;
+    
+    typedef Find24Counters Counters;
+    Counters counters_;
+    
+    struct StopCond {
+        bool has_deadline;
+        Clock::time_point deadline;
+        const std::atomic<bool>* cancel;
+        Status status;
+        StopCond() : has_deadline(false), cancel(nullptr),
+        status(Status::OK) { }
+        
+        // sticky: once stopped, stays stopped
+        bool stopped() {
+            if (status != Status::OK) return true;
+            if (cancel && cancel->load(std::memory_order_relaxed)) {
+                status = Status::CANCELLED;
+            } else if (has_deadline && Clock::now() >= deadline) {
+                status = Status::TIMEOUT;
+            }
+            return status != Status::OK;
+        }
+    } stop_;
+    
+    typedef OpCode Op;
+    
+    bool profile_;
+    struct PhaseStats {
+        std::string name;
+        int size; // of the subsets built
+        double millis;
+        Counters counters;
+        PerfCounters::Sample perf;
+    };
+    std::vector<PhaseStats> phases_;
+    std::unique_ptr<PerfCounters> perf_;
+    class Phase;
+    
+    class Ranker;
+    std::unique_ptr<Ranker> ranker_;
+    std::vector<const Expr*> ranked_;
+    
+    std::string checkpoint_path_;
+    Clock::duration checkpoint_interval_;
+    Clock::time_point last_checkpoint_;
+    Clock::duration checkpoint_cost_; // of writing the last one
+    int checkpoint_subsets_; // subsets and csubsets in the last one
+    
+    bool count_only_;
+    uint64_t count_;
+    
+    ProgressCallback progress_;
+    Find24Progress where_;
+    Clock::time_point run_start_;
+    Clock::time_point phase_start_;
+    
+    void startProgress();
+    void startPhaseProgress(const char* name, int size);
+    void endPhaseProgress();
+    void reportProgress();
+    // after each subset of a phase
+    void subsetDone() {
+        if (!progress_) return;
+        ++where_.done;
+        ++where_.done_all;
+        reportProgress();
+    }
+    
+    void printCounters() const;
+    void printPhases() const;
+};
 
 // Although the name comes from the game find-24, this class is a general
 // solution that can find arithmatic expressions that would yield a specific
@@ -30,50 +276,59 @@ typedef std::map<NumVec, ValSet> ConstraintMap;
 // (instead of 4 integers between 1 to 13).
 // It will find all possible solutions, but will not show duplicates under
 // commutative or associative laws.
-class Find24 {
+// Int is the integer type of the values, it must be wide enough for the
+// input (see chooseIntWidth()). It is instantiated for int32_t, int64_t and
+// __int128 in find24.cpp.
+template<typename Int>
+class BasicFind24 : public Find24Base {
 public:
-    Find24(int target, std::vector<int>& elems) :
-    target_(target), elems_(elems)
-    {
-        std::sort(elems_.begin(), elems_.end());
-    }
+    typedef BasicRational<Int> Rational;
+    typedef std::map<Rational, ExprSet> ValExprMap;
+    typedef std::map<NumVec, ValExprMap> SolutionMap;
+    typedef std::set<Rational> ValSet;
+    typedef std::map<NumVec, ValSet> ConstraintMap;
+    
+    BasicFind24(int target, const std::vector<int>& elems) :
+    Find24Base(target, elems) { }
     
-    void run(bool debug);
+    Status run(bool debug);
     
+    // empty unless run() returned Status::OK
     std::vector<std::string> getExprs() const;
     
-    ~Find24() {
+    // the solutions themselves, nullptr unless there are any
+    const ExprSet* getExprSet() const;
+    
+    ~BasicFind24() {
         freeSolutionMap();
     }
     
 private:
-    int target_;
-    NumVec elems_;
     SolutionMap solution_;
     ConstraintMap constraint_;
     
-    struct Counters {
-        int subsets;
-        int combos;
-        int newvalues;
-        int valcombos;
-        int exprcombos;
-        int uniqexprs;
-        int csubsets;
-        int ccombos;
-        int cvalcombos;
-        Counters() : subsets(0), combos(0), newvalues(0), valcombos(0),
-        exprcombos(0), uniqexprs(0), csubsets(0), ccombos(0), cvalcombos(0) { }
-    } counters_;
-    
     void addLiterals();
     void addRootConstraint();
-    class ValueBuilder;
-    class SolutionBuilder;
-    class CVBuilder;
-    class ConstraintBuilder;
+    void addFeatures();
+    // the builders are instantiated for the operator sets of opset.hpp, so
+    // that their loops only have the operators the limits allow
+    template<typename Ops> class ValueBuilder;
+    template<typename Ops> class SolutionBuilder;
+    template<typename Ops> class CVBuilder;
+    template<typename Ops> class ConstraintBuilder;
+    class LayerBuilder;
+    template<typename Ops> void buildLayers();
+    template<typename Ops> void buildRootSharded();
+    struct Shard;
+    template<typename Ops> void runShard(int worker, Shard& shard);
     void buildSolutionMap();
     void freeSolutionMap();
+    bool usesCheckpoint() const;
+    void checkpoint();
+    bool saveCheckpoint() const;
+    bool loadCheckpoint();
 };
 
+typedef BasicFind24<int64_t> Find24;
+
 #endif /* find24_hpp */
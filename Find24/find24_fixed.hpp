@@ -0,0 +1,385 @@
+//
+//  find24_fixed.hpp
+//  Find24
+//
+
+#ifndef find24_fixed_hpp
+#define find24_fixed_hpp
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <iostream>
+
+#include "find24.hpp"
+#include "literal.hpp"
+#include "opset.hpp"
+
+// Specialized version of Find24 for a small, fixed number of elements (the
+// classic game has 4). Subsets are bit masks over the N elements instead of
+// sorted NumVec keys, so the per-subset tables live in a fixed array indexed
+// by mask, and the split of a subset into two halves is a submask walk with
+// a compile-time bound. The constraint phase and the joins of the
+// constrained masks follow Find24 but work on masks as well, and all of it
+// is driven by the operator policies of opset.hpp.
+// Equal elements are interchangeable, so, as with Find24's NumVec keys, the
+// masks that only differ in which copies they use share one table (see
+// canon_).
+// It produces exactly the same expressions, in the same order, as Find24.
+// Int has the same meaning as in BasicFind24.
+template<int N, typename Int>
+class Find24Fixed {
+public:
+    static_assert(N>=2 && N<=5, "Find24Fixed is meant for 2 to 5 elements");
+    
+    typedef typename BasicFind24<Int>::Rational Rational;
+    typedef typename BasicFind24<Int>::ValExprMap ValExprMap;
+    typedef typename BasicFind24<Int>::ValSet ValSet;
+
+    Find24Fixed(int target, const std::vector<int>& elems) :
+    target_(target), subsets_(0), valcombos_(0), exprcombos_(0),
+    uniqexprs_(0)
+    {
+        assert(elems.size() == N);
+        std::copy(elems.begin(), elems.end(), elems_);
+        std::sort(elems_, elems_+N);
+        for (int mask=0; mask<=FULL; ++mask) canon_[mask]=canonical(mask);
+    }
+
+    // same as Find24Base::setLimits()
+    void setLimits(const SearchLimits& limits) {
+        limits_ = limits.effective();
+        root_limits_ = limits_.atRoot(target_);
+    }
+    
+    void run(bool debug) {
+        LayerBuilder lb(*this);
+        dispatchOpSet(limits_.ops, lb);
+
+        if (debug) {
+            std::cout << "counters: " << std::endl <<
+            "subsets=" << subsets_ << std::endl <<
+            "valcombos=" << valcombos_ << std::endl <<
+            "exprcombos=" << exprcombos_ << std::endl <<
+            "uniqexprs=" << uniqexprs_ << std::endl <<
+            std::endl;
+        }
+    }
+
+    std::vector<std::string> getExprs() const {
+        std::vector<std::string> ret;
+        const ExprSet* exprs=getExprSet();
+        if (!exprs) {
+            return ret;
+        }
+
+        for (auto& expr : *exprs) {
+            ret.push_back(expr->toString(false));
+        }
+
+        return ret;
+    }
+
+    const ExprSet* getExprSet() const {
+        auto it=values_[FULL].find(Rational(target_));
+        if (it == values_[FULL].end() || it->second.empty()) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    int getTarget() const { return target_; }
+    
+    // only the counters that mean the same here as in Find24
+    Find24Counters getCounters() const {
+        Find24Counters ret;
+        ret.subsets=subsets_;
+        ret.valcombos=valcombos_;
+        ret.exprcombos=exprcombos_;
+        ret.uniqexprs=uniqexprs_;
+        return ret;
+    }
+    
+    // always empty, ranking is left to Find24 (see Find24Base::setTopK())
+    const std::vector<const Expr*>& getRanked() const { return ranked_; }
+
+    ~Find24Fixed() {
+        for (auto& value : values_) {
+            for (auto& y : value) {
+                for (auto& z : y.second) {
+                    delete z;
+                }
+            }
+        }
+    }
+
+private:
+    enum { FULL = (1<<N) - 1 };
+    typedef typename ValExprMap::value_type Values;
+
+    int target_;
+    int elems_[N];
+    // the mask with the same values as mask that uses the first copies of
+    // each, the only one with a table of its own
+    int canon_[FULL+1];
+    SearchLimits limits_;
+    SearchLimits root_limits_; // for the whole expression, see atRoot()
+    std::vector<const Expr*> ranked_;
+    ValExprMap values_[FULL+1];
+    ValSet allowed_[FULL+1];
+    int subsets_;
+    int valcombos_;
+    int exprcombos_;
+    int uniqexprs_;
+
+    static constexpr int lowestBit(int mask) { return mask & -mask; }
+
+    static constexpr int popCount(int mask) {
+        return mask ? (mask & 1) + popCount(mask >> 1) : 0;
+    }
+
+    static constexpr bool isLarge(int mask) { return popCount(mask) > N/2; }
+
+    // elems_ is sorted, so equal values are next to each other, and each
+    // element of mask moves to the first copy of its value not taken yet
+    int canonical(int mask) const {
+        int ret=0;
+        for (int i=0; i<N; ++i) {
+            if (!(mask & (1<<i))) continue;
+            int j=i;
+            while (j > 0 && elems_[j-1] == elems_[i]) --j;
+            while (ret & (1<<j)) ++j;
+            ret|=1<<j;
+        }
+        return ret;
+    }
+
+    bool isCanonical(int mask) const { return canon_[mask] == mask; }
+
+    // runs buildLayers() for the operator set of the limits
+    class LayerBuilder {
+    public:
+        LayerBuilder(Find24Fixed& p) : p_(p) { }
+        template<typename Ops> void run() { p_.template buildLayers<Ops>(); }
+
+    private:
+        Find24Fixed& p_;
+    };
+
+    // A mask is always built after all of its submasks, and the masks with
+    // more than N/2 elements are constrained by the values that could still
+    // lead to the target.
+    template<typename Ops>
+    void buildLayers() {
+        for (int i=0; i<N; ++i) {
+            if (!isCanonical(1<<i)) continue; // the same literal as before
+            values_[1<<i].insert({elems_[i], {new Literal(elems_[i])}});
+            ++subsets_;
+        }
+
+        for (int mask=1; mask<=FULL; ++mask) {
+            if (isLarge(mask) || !isCanonical(mask)) continue;
+            if (mask & (mask-1)) buildMask<Ops>(mask, nullptr);
+        }
+
+        allowed_[FULL].insert(target_);
+        for (int mask=FULL-1; mask>0; --mask) {
+            if (isLarge(mask) && isCanonical(mask)) buildConstraint<Ops>(mask);
+        }
+
+        for (int mask=1; mask<=FULL; ++mask) {
+            if (isLarge(mask) && isCanonical(mask)) {
+                buildMask<Ops>(mask, &allowed_[mask]);
+            }
+        }
+    }
+
+    // Same as Find24::CVBuilder: every value of mask that, combined with a
+    // value of some other disjoint subset, gives an allowed value of the
+    // union. Larger masks are always done first, and the others with the
+    // same values are only tried once.
+    template<typename Ops>
+    void buildConstraint(int mask) {
+        const int rest=FULL^mask;
+        uint32_t seen=0; // by canonical mask
+        for (int other=rest; other; other=(other-1)&rest) {
+            const int canon=canon_[other];
+            if (seen & (1u<<canon)) continue;
+            seen|=1u<<canon;
+            for (auto& i : allowed_[canon_[mask|other]]) {
+                for (auto& j : values_[canon]) {
+                    Deduce deduce={*this, allowed_[mask], i, j.first};
+                    Ops::each(deduce, limits_.ops);
+                }
+            }
+        }
+    }
+
+    // the values of a mask for one operator of Ops
+    struct Deduce {
+        Find24Fixed& f;
+        ValSet& value;
+        const Rational& sum;
+        const Rational& other;
+
+        template<typename Operator> void apply() {
+            solveOp<Operator>(sum, other, f.limits_, *this);
+        }
+
+        // called by the operator with each value deduced
+        void operator() (const Rational& result) {
+            if (f.limits_.admits(result)) value.insert(result);
+        }
+    };
+
+    // where the values built for a mask go
+    struct Target {
+        ValExprMap& value;
+        const ValSet* allowed;
+        const SearchLimits& limits;
+    };
+
+    // Every unordered split {s1, s2} of mask is visited once, with s1
+    // holding the lowest element, and the splits with the same values on
+    // both sides only once. The operators cover both orders.
+    template<typename Ops>
+    void buildMask(int mask, const ValSet* allowed) {
+        Target target={values_[mask], allowed,
+            (mask == FULL) ? root_limits_ : limits_};
+        const int low=lowestBit(mask);
+        uint32_t seen=0; // by the smaller canonical half
+        for (int s1=(mask-1)&mask; s1; s1=(s1-1)&mask) {
+            if (!(s1 & low)) continue;
+            const int c1=canon_[s1], c2=canon_[mask^s1];
+            const int half=std::min(c1, c2);
+            if (seen & (1u<<half)) continue;
+            seen|=1u<<half;
+            if (joinable(allowed, values_[c1], values_[c2])) {
+                join<Ops>(target, values_[c1], values_[c2]);
+                continue;
+            }
+            for (auto& i : values_[c1]) {
+                for (auto& j : values_[c2]) {
+                    ++valcombos_;
+                    Pair pair={*this, target, i, j};
+                    Ops::each(pair, target.limits.ops);
+                }
+            }
+        }
+        ++subsets_;
+    }
+
+    // applies each operator of Ops to a pair of values
+    struct Pair {
+        Find24Fixed& f;
+        const Target& target;
+        const Values& left;
+        const Values& right;
+
+        template<typename Operator> void apply() {
+            f.template combine<Operator>(target, left, right);
+            if (!Operator::commutative) {
+                f.template combine<Operator>(target, right, left);
+            }
+        }
+    };
+
+    // Same as Find24::ValueBuilder::joinable(): with fewer allowed values
+    // than one side has values (the root only allows the target), the
+    // values the other side needs are looked up instead of trying every
+    // pair. 0 is left to the full scan, since e.g. 0*x = 0 for every x.
+    static bool joinable(const ValSet* allowed, const ValExprMap& s1_vals,
+                         const ValExprMap& s2_vals)
+    {
+        return allowed && !allowed->count(Rational(0)) &&
+        allowed->size() < std::max(s1_vals.size(), s2_vals.size());
+    }
+
+    template<typename Ops>
+    void join(const Target& target, const ValExprMap& s1_vals,
+              const ValExprMap& s2_vals)
+    {
+        const bool from_s1=(s1_vals.size() <= s2_vals.size());
+        const ValExprMap& scan=(from_s1 ? s1_vals : s2_vals);
+        const ValExprMap& other=(from_s1 ? s2_vals : s1_vals);
+        for (auto& x : scan) {
+            Join join={*this, target, x, other, from_s1};
+            Ops::each(join, target.limits.ops);
+        }
+    }
+
+    // for a value x of one side, looks up the values of the other side that
+    // give an allowed value with each operator of Ops, in the same order of
+    // operands as Pair
+    struct Join {
+        Find24Fixed& f;
+        const Target& target;
+        const Values& x;
+        const ValExprMap& other;
+        bool s1; // x is from s1
+
+        template<typename Operator> void apply() {
+            for (auto& sum : *target.allowed) {
+                if (!Operator::commutative || s1) {
+                    Probe<Operator> probe={f, target, x, other, true};
+                    Operator::solveRight(sum, x.first, target.limits, probe);
+                }
+                if (!Operator::commutative || !s1) {
+                    Probe<Operator> probe={f, target, x, other, false};
+                    Operator::solveLeft(sum, x.first, target.limits, probe);
+                }
+            }
+        }
+    };
+
+    // calls combine() for x and the value of other it is looked up in
+    template<typename Operator>
+    struct Probe {
+        Find24Fixed& f;
+        const Target& target;
+        const Values& x;
+        const ValExprMap& other;
+        bool left; // x is the left operand
+
+        void operator() (const Rational& y) {
+            auto it=other.find(y);
+            if (it == other.end()) return;
+            ++f.valcombos_;
+            if (left) {
+                f.template combine<Operator>(target, x, *it);
+            } else {
+                f.template combine<Operator>(target, *it, x);
+            }
+        }
+    };
+
+    // same rules as Find24::ValueBuilder::doOp(), including the tie-break
+    // for x op y = y op x when x and y have the same value.
+    template<typename Operator>
+    void combine(const Target& target, const Values& left,
+                 const Values& right)
+    {
+        Rational result(0);
+        if (!Operator::apply(left.first, right.first, target.limits, result)) {
+            return;
+        }
+        if (!target.limits.admits(result)) return;
+        if (target.allowed && !target.allowed->count(result)) return;
+
+        ExprSet& exprs=target.value[result];
+        bool tie=!Operator::commutative && left.first == right.first;
+        for (auto& lexpr : left.second) {
+            for (auto& rexpr : right.second) {
+                ++exprcombos_;
+                if (tie && cmpExpr(lexpr, rexpr)>0) continue;
+                std::unique_ptr<Expr> expr(Operator::make(lexpr, rexpr));
+                if (exprs.insert(expr.get()).second) {
+                    ++uniqexprs_;
+                    expr.release();
+                }
+            }
+        }
+    }
+};
+
+#endif /* find24_fixed_hpp */
@@ -7,11 +7,164 @@
 //
 
 #include "find24_simple.hpp"
-#include "find24.hpp"
+#include "solver.hpp"
+#include "dagfile.hpp"
 
-std::vector<std::string> find24(int target, std::vector<int>& elems)
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+// Rewrites a single line on stderr with where the search is, at most ten
+// times a second, and ends it once the root is done.
+class ProgressLine {
+public:
+    ProgressLine() : width_(0), ended_(false) { }
+    
+    void operator() (const Find24Progress& where) {
+        const bool last=(strcmp(where.phase, "root") == 0 &&
+                         where.done == where.total);
+        if (last && ended_) return; // the root's subset, then its end
+        ended_=last;
+        Find24Base::Clock::time_point now=Find24Base::Clock::now();
+        if (!last && width_ > 0 &&
+            now-shown_ < std::chrono::milliseconds(100)) {
+            return;
+        }
+        shown_=now;
+        
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1) << where.phase << " " <<
+        where.size << ": " << where.done << "/" << where.total << ", " <<
+        where.done_all << "/" << where.total_all << " subsets, " <<
+        where.values << " values, " << where.exprs << " exprs, " <<
+        where.seconds << "s";
+        if (where.eta >= 0) line << ", " << where.eta << "s left in phase";
+        std::string text=line.str();
+        size_t width=text.size();
+        if (text.size() < width_) text.append(width_-text.size(), ' ');
+        width_=width;
+        std::cerr << "\r" << text;
+        if (last) std::cerr << std::endl;
+    }
+    
+private:
+    size_t width_; // of the line shown, 0 before the first one
+    bool ended_;
+    Find24Base::Clock::time_point shown_;
+};
+
+Find24Base::ProgressCallback progressLine() {
+    return ProgressLine();
+}
+
+// options with debug as given, for the calls below to fill in
+static SolverOptions makeOptions(const SolverOptions& from, bool debug)
+{
+    SolverOptions options=from;
+    options.debug=debug;
+    return options;
+}
+
+// "Found N solutions" (TEXT only), then the solutions one per line
+static size_t printSolutions(const SolutionView& view, const char* what,
+                             ExprWriter& out, OutputFormat format)
+{
+    if (view.empty()) return 0;
+    if (format == OutputFormat::TEXT) {
+        out.put("Found ");
+        out.putInt(view.size());
+        out.put(what);
+    }
+    view.writeAll(out, format);
+    return view.size();
+}
+
+std::vector<std::string> find24(int target, const std::vector<int>& elems,
+                                int workers, const SearchLimits& limits)
+{
+    SolverOptions options;
+    options.workers=workers;
+    options.limits=limits;
+    Solver solver(makeOptions(options, false));
+    solver.solve(target, elems);
+    SolutionView view=solver.solutions();
+    std::vector<std::string> exprs;
+    exprs.reserve(view.size());
+    for (size_t i=0; i<view.size(); ++i) exprs.push_back(view.str(i));
+    return exprs;
+}
+
+size_t find24(int target, const std::vector<int>& elems,
+              const SolverOptions& options, ExprWriter& out,
+              OutputFormat format)
 {
-    Find24 helper(target, elems);
-    helper.run(true); // show debugging statistics
-    return helper.getExprs();
+    // statistics would get in the way of machine-readable output
+    Solver solver(makeOptions(options, format == OutputFormat::TEXT));
+    solver.solve(target, elems);
+    return printSolutions(solver.solutions(), " solutions\n", out, format);
+}
+
+long find24(int target, const std::vector<int>& elems,
+            const SolverOptions& options, const char* path)
+{
+    Solver solver(makeOptions(options, true)); // show debugging statistics
+    solver.solve(target, elems);
+    const ExprSet* exprs=solver.getExprSet();
+    ExprSet none;
+    if (!writeDagFile(path, exprs ? *exprs : none, target)) return -1;
+    return exprs ? (long)exprs->size() : 0;
+}
+
+uint64_t find24Count(int target, const std::vector<int>& elems,
+                     const SolverOptions& options)
+{
+    SolverOptions counting=makeOptions(options, false);
+    counting.count_only=true;
+    Solver solver(counting);
+    solver.solve(target, elems);
+    return solver.count();
+}
+
+size_t find24TopK(int target, const std::vector<int>& elems, int k,
+                  const SolverOptions& options, ExprWriter& out,
+                  OutputFormat format)
+{
+    SolverOptions ranking=makeOptions(options, format == OutputFormat::TEXT);
+    ranking.topk=k;
+    Solver solver(ranking);
+    solver.solve(target, elems);
+    return printSolutions(solver.solutions(), " simplest solutions\n", out,
+                          format);
+}
+
+bool find24Beam(int target, const std::vector<int>& elems, int timeout_ms,
+                uint64_t seed, const SolverOptions& options, ExprWriter& out,
+                OutputFormat format)
+{
+    SolverOptions beam=makeOptions(options, format == OutputFormat::TEXT);
+    beam.engine=Engine::BEAM;
+    beam.seed=seed;
+    beam.timeout=std::chrono::milliseconds(timeout_ms);
+    Solver solver(beam);
+    solver.solve(target, elems);
+
+    const Expr* expr=solver.getClosest();
+    if (!expr) return false;
+    std::string value=solver.getClosestValue();
+    if (format == OutputFormat::JSON) {
+        out.put("{\"expr\":\"");
+        expr->write(out, false);
+        out.put("\",\"target\":");
+        out.putInt(target);
+        out.put(",\"value\":\"");
+        out.put(value.c_str());
+        out.put("\"}\n");
+    } else {
+        expr->write(out, false);
+        out.put('=');
+        out.put(value.c_str());
+        out.put('\n');
+    }
+    return !solver.solutions().empty();
 }
@@ -11,7 +11,56 @@
 
 #include <vector>
 #include <string>
+#include <stdint.h>
+#include "exprwriter.hpp"
+#include "searchlimits.hpp"
+#include "solver.hpp"
 
-std::vector<std::string> find24(int target, std::vector<int>& elems);
+// A callback for SolverOptions::progress that shows where an exact search
+// is on a line of stderr, rewritten as it goes (see
+// Find24Base::setProgress()).
+Find24Base::ProgressCallback progressLine();
+
+// workers > 1 shares the last layer of large solves with that many threads.
+// Only intermediate results within limits are considered.
+std::vector<std::string> find24(int target, const std::vector<int>& elems,
+                                int workers=1,
+                                const SearchLimits& limits=SearchLimits());
+
+// The ones below take the workers, limits, progress and checkpoint from
+// options, and set what else they need themselves.
+
+// Same as above, but prints the solutions to out instead, one per line.
+// TEXT starts with a "Found N solutions" line, JSON writes one object per
+// line and nothing else. Returns the number of solutions.
+size_t find24(int target, const std::vector<int>& elems,
+              const SolverOptions& options, ExprWriter& out,
+              OutputFormat format);
+
+// Same as above, but saves the solutions to path in the binary format of
+// dagfile.hpp. Returns the number of solutions, or -1 if the file cannot be
+// written.
+long find24(int target, const std::vector<int>& elems,
+            const SolverOptions& options, const char* path);
+
+// Same as above, but only counts the solutions (see
+// Find24Base::setCountOnly()), which takes far less memory than building
+// them.
+uint64_t find24Count(int target, const std::vector<int>& elems,
+                     const SolverOptions& options);
+
+// Same as above, but only the k simplest solutions (see exprcost.hpp) are
+// kept, and printed simplest first.
+size_t find24TopK(int target, const std::vector<int>& elems, int k,
+                  const SolverOptions& options, ExprWriter& out,
+                  OutputFormat format);
+
+// Heuristic search for inputs too large for the exact solver (see
+// beam24.hpp). Prints the closest expression found within timeout_ms, as
+// "expr=value" in TEXT, or with an extra "value" field in JSON. Returns true
+// if it equals target. The same seed gives the same search.
+bool find24Beam(int target, const std::vector<int>& elems, int timeout_ms,
+                uint64_t seed, const SolverOptions& options, ExprWriter& out,
+                OutputFormat format);
 
 #endif /* find24_simple_hpp */
@@ -23,8 +23,8 @@ public:
         return lit_ - expr->lit_;
     }
     
-    std::string toString(bool embed) const {
-        return std::to_string(lit_);
+    void write(ExprWriter& out, bool embed) const {
+        out.putInt(lit_);
     }
     
     ExprType getType() const {
@@ -35,6 +35,10 @@ public:
         return rank_;
     }
     
+    int getValue() const {
+        return lit_;
+    }
+    
 private:
     const int lit_;
     Rank rank_;
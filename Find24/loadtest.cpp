@@ -0,0 +1,234 @@
+//
+//  loadtest.cpp
+//  Find24
+//
+
+// Drives the Solver library API (one reused Solver per client thread) with a
+// seeded stream of puzzles, and reports throughput, latency percentiles and
+// peak memory. Build with "make loadtest".
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "solver.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Puzzle {
+    int target;
+    std::vector<int> elems;
+};
+
+// The kinds of hands in the stream, roughly as they show up in real games.
+enum { CLASSIC, DUPLICATES, LARGE, UNSOLVABLE, KINDS };
+
+static int card(std::mt19937_64& rng) {
+    return 1+(int)(rng()%13);
+}
+
+static Puzzle makePuzzle(std::mt19937_64& rng, int kind, int maxn) {
+    Puzzle p;
+    switch (kind) {
+        case CLASSIC: // 4 cards for 24
+            p.target=24;
+            for (int i=0; i<4; ++i) p.elems.push_back(card(rng));
+            break;
+        case DUPLICATES: { // 4 to 6 cards of at most 2 different values
+            int n=4+(int)(rng()%3);
+            int a=card(rng), b=card(rng);
+            p.target=(rng()%2) ? 24 : 1+(int)(rng()%100);
+            for (int i=0; i<std::min(n, maxn); ++i) {
+                p.elems.push_back((rng()%3) ? a : b);
+            }
+            break;
+        }
+        case LARGE: { // 5 to maxn cards for 24 or some other target
+            int n=5+(int)(rng()%std::max(1, maxn-4));
+            p.target=(rng()%2) ? 24 : 1+(int)(rng()%1000);
+            for (int i=0; i<std::min(n, maxn); ++i) p.elems.push_back(card(rng));
+            break;
+        }
+        default: { // no value built from elems can reach prod(elem+1)
+            int n=3+(int)(rng()%2);
+            int64_t bound=1;
+            for (int i=0; i<n; ++i) {
+                p.elems.push_back(card(rng));
+                bound*=p.elems.back()+1;
+            }
+            p.target=(int)bound;
+            break;
+        }
+    }
+    return p;
+}
+
+static double percentile(const std::vector<double>& sorted, double pct) {
+    if (sorted.empty()) return 0;
+    size_t index=(size_t)(pct/100*(sorted.size()-1)+0.5);
+    return sorted[std::min(index, sorted.size()-1)];
+}
+
+int main(int argc, char* argv[])
+{
+    int requests=1000;
+    int threads=4;
+    double rate=0; // closed loop
+    bool poisson=false;
+    uint64_t seed=1;
+    int maxn=6;
+    int weights[KINDS]={60, 15, 15, 10};
+    bool count=false;
+    int opt;
+    while ((opt=getopt(argc, argv, "n:t:r:es:N:w:c")) != -1) {
+        switch (opt) {
+            case 'n':
+                requests=atoi(optarg);
+                break;
+            case 't':
+                threads=atoi(optarg);
+                break;
+            case 'r':
+                rate=atof(optarg);
+                break;
+            case 'e':
+                poisson=true;
+                break;
+            case 's':
+                seed=strtoull(optarg, nullptr, 10);
+                break;
+            case 'N':
+                maxn=atoi(optarg);
+                break;
+            case 'w':
+                if (sscanf(optarg, "%d,%d,%d,%d", &weights[CLASSIC],
+                           &weights[DUPLICATES], &weights[LARGE],
+                           &weights[UNSOLVABLE]) != KINDS) {
+                    argc=0;
+                }
+                break;
+            case 'c':
+                count=true;
+                break;
+            default:
+                argc=0; // show usage
+                break;
+        }
+    }
+
+    if (argc == 0 || requests<1 || threads<1 || rate<0 || maxn<5) {
+        std::cerr << "Usage: " << argv[0] << " [-n requests] [-t threads] [-r rate [-e]] [-s seed] [-N maxn] [-w classic,dup,large,unsolvable] [-c]"
+        << std::endl <<
+        "  -r sends requests at a fixed rate per second instead of back to back,"
+        << std::endl <<
+        "     -e makes the gaps exponential (open-loop Poisson arrivals)"
+        << std::endl <<
+        "  -c only counts the solutions, and checks each count against the"
+        << std::endl <<
+        "     solutions of a full solve, run after the timed stream" << std::endl;
+        return -1;
+    }
+
+    // the whole stream, and when each request arrives, is decided up front
+    std::mt19937_64 rng(seed);
+    std::discrete_distribution<int> kinds(weights, weights+KINDS);
+    std::exponential_distribution<double> gaps(rate > 0 ? rate : 1);
+    std::vector<Puzzle> puzzles;
+    std::vector<Clock::duration> arrivals;
+    double at=0;
+    for (int i=0; i<requests; ++i) {
+        puzzles.push_back(makePuzzle(rng, kinds(rng), maxn));
+        if (rate > 0) {
+            arrivals.push_back(std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(at)));
+            at+=poisson ? gaps(rng) : 1/rate;
+        }
+    }
+
+    // With a rate, latency counts from the scheduled arrival, so time spent
+    // waiting for a free client thread shows up in the tail.
+    std::vector<double> latencies(requests);
+    std::vector<char> solved(requests);
+    std::vector<size_t> counts(requests);
+    std::atomic<int> next(0);
+    const Clock::time_point start=Clock::now();
+    auto client=[&]() {
+        SolverOptions options;
+        options.count_only=count;
+        Solver solver(options);
+        ExprWriter out;
+        while (true) {
+            int i=next++;
+            if (i >= requests) break;
+            Clock::time_point arrival=start;
+            if (rate > 0) {
+                arrival+=arrivals[i];
+                std::this_thread::sleep_until(arrival);
+            } else {
+                arrival=Clock::now();
+            }
+            const Puzzle& p=puzzles[i];
+            solver.solve(p.target, p.elems);
+            SolutionView view=solver.solutions();
+            out.clear();
+            view.writeAll(out, OutputFormat::JSON);
+            solved[i]=(solver.count() > 0);
+            counts[i]=solver.count();
+            latencies[i]=std::chrono::duration<double, std::micro>(
+                Clock::now()-arrival).count();
+        }
+    };
+    std::vector<std::thread> clients;
+    for (int t=0; t<threads; ++t) clients.emplace_back(client);
+    for (auto& t : clients) t.join();
+    double elapsed=std::chrono::duration<double>(Clock::now()-start).count();
+
+    std::sort(latencies.begin(), latencies.end());
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    // the counts are checked once the clock has stopped, so that the full
+    // solves take no client time away from the stream
+    std::atomic<int> mismatches(0);
+    if (count) {
+        next=0;
+        auto checker=[&]() {
+            Solver full;
+            while (true) {
+                int i=next++;
+                if (i >= requests) break;
+                const Puzzle& p=puzzles[i];
+                full.solve(p.target, p.elems);
+                if (full.solutions().size() == counts[i]) continue;
+                ++mismatches;
+                std::string hand;
+                for (int elem : p.elems) hand+=" "+std::to_string(elem);
+                std::cerr << "Oops, counted " << counts[i] <<
+                " solutions instead of " << full.solutions().size() <<
+                " for " << p.target << ":" << hand << std::endl;
+            }
+        };
+        std::vector<std::thread> checkers;
+        for (int t=0; t<threads; ++t) checkers.emplace_back(checker);
+        for (auto& t : checkers) t.join();
+    }
+    std::cout << "requests=" << requests << std::endl <<
+    "solved=" << std::count(solved.begin(), solved.end(), 1) << std::endl <<
+    "threads=" << threads << std::endl <<
+    "elapsed_s=" << elapsed << std::endl <<
+    "throughput_rps=" << requests/elapsed << std::endl <<
+    "p50_us=" << percentile(latencies, 50) << std::endl <<
+    "p99_us=" << percentile(latencies, 99) << std::endl <<
+    "p999_us=" << percentile(latencies, 99.9) << std::endl <<
+    "max_us=" << latencies.back() << std::endl <<
+    "peak_rss_kb=" << usage.ru_maxrss << std::endl;
+    if (count) std::cout << "count_mismatches=" << mismatches << std::endl;
+
+    return mismatches ? 1 : 0;
+}
@@ -8,24 +8,117 @@
 
 #include <iostream>
 #include <vector>
+#include <cstdlib>
+#include <unistd.h>
 #include "find24_simple.hpp"
+#include "dagfile.hpp"
 
 int main(int argc, char* argv[])
 {
-    if (argc<3) {
-        std::cerr << "Usage: " << argv[0] << " <target> <n1> <n2> ... "
+    int workers=1;
+    OutputFormat format=OutputFormat::TEXT;
+    const char* save_path=nullptr;
+    const char* read_path=nullptr;
+    const char* checkpoint_path=nullptr;
+    bool count_only=false;
+    bool progress=false;
+    SearchLimits limits;
+    int topk=0;
+    int beam_ms=0;
+    uint64_t seed=1;
+    int opt;
+    while ((opt=getopt(argc, argv, "j:Jo:r:cIm:d:x:pPC:b:s:k:")) != -1) {
+        switch (opt) {
+            case 'j':
+                workers=atoi(optarg);
+                break;
+            case 'J':
+                format=OutputFormat::JSON;
+                break;
+            case 'o':
+                save_path=optarg;
+                break;
+            case 'r':
+                read_path=optarg;
+                break;
+            case 'c':
+                count_only=true;
+                break;
+            case 'I':
+                limits.integer_only=true;
+                break;
+            case 'm':
+                limits.max_dividend=atoll(optarg);
+                break;
+            case 'd':
+                limits.max_divisor=atoll(optarg);
+                break;
+            case 'k':
+                topk=atoi(optarg);
+                break;
+            case 'b':
+                beam_ms=atoi(optarg);
+                break;
+            case 's':
+                seed=strtoull(optarg, nullptr, 10);
+                break;
+            case 'x':
+                for (const char* p=optarg; *p; ++p) {
+                    switch (*p) {
+                        case '+': limits.ops&=~SearchLimits::PLUS; break;
+                        case '-': limits.ops&=~SearchLimits::MINUS; break;
+                        case '*': limits.ops&=~SearchLimits::MULTIPLE; break;
+                        case '/': limits.ops&=~SearchLimits::DIVISION; break;
+                        default: argc=0; break;
+                    }
+                }
+                break;
+            case 'p':
+                limits.ops|=SearchLimits::POWER;
+                break;
+            case 'P':
+                progress=true;
+                break;
+            case 'C':
+                checkpoint_path=optarg;
+                break;
+            default:
+                argc=0; // show usage
+                break;
+        }
+    }
+    
+    if (read_path && argc>0) {
+        DagReader reader;
+        if (!reader.open(read_path)) {
+            std::cerr << "cannot read solutions from " << read_path
+            << std::endl;
+            return -1;
+        }
+        if (count_only) {
+            std::cout << reader.size() << std::endl;
+        } else {
+            ExprWriter out(stdout);
+            reader.print(out, format);
+        }
+        return 0;
+    }
+    
+    if (argc-optind<2) {
+        std::cerr << "Usage: " << argv[0] << " [-j workers] [-J] [-o file] [-I] [-m max] [-d max] [-x ops] [-p] [-P] [-C file] [-k count | -c] [-b ms [-s seed]] <target> <n1> <n2> ... "
+        << std::endl << "       " << argv[0] << " -r file [-J] [-c]"
         << std::endl;
         return -1;
     }
     
-    int target=atoi(argv[1]);
+    int target=atoi(argv[optind]);
     if (target<=0) {
         std::cerr << "target must be a positive number" << std::endl;
         return -1;
     }
     
     std::vector<int> elems;
-    for (int i=2; i<argc; ++i) {
+    for (int i=optind+1; i<argc; ++i) {
         int elem=atoi(argv[i]);
         if (elem<=0) {
             std::cerr << "input must be positive number(s)" << std::endl;
@@ -34,14 +127,60 @@ int main(int argc, char* argv[])
         elems.push_back(elem);
     }
     
-    auto exprs = find24(target, elems);
-    if (exprs.empty()) {
-        std::cerr << "Oops, no solution found!" << std::endl;
-    } else {
-        std::cout << "Found " << exprs.size() << " solutions" << std::endl;
-        for (auto& expr : exprs) {
-            std::cout << expr << "=" << target << std::endl;
+    if (workers<1) {
+        std::cerr << "number of workers must be positive" << std::endl;
+        return -1;
+    }
+    
+    if (limits.max_dividend<0 || limits.max_divisor<0) {
+        std::cerr << "limits must not be negative" << std::endl;
+        return -1;
+    }
+    
+    SolverOptions options;
+    options.workers=workers;
+    options.limits=limits;
+    if (progress) options.progress=progressLine();
+    if (checkpoint_path) options.checkpoint=checkpoint_path;
+    options.profile=(getenv("FIND24_PROFILE") != nullptr);
+    
+    if (beam_ms > 0) {
+        ExprWriter out(stdout);
+        if (!find24Beam(target, elems, beam_ms, seed, options, out, format)) {
+            out.flush();
+            std::cerr << "Oops, no exact solution found!" << std::endl;
+        }
+        return 0;
+    }
+    
+    if (topk > 0) {
+        ExprWriter out(stdout);
+        if (find24TopK(target, elems, topk, options, out, format) == 0) {
+            out.flush();
+            std::cerr << "Oops, no solution found!" << std::endl;
+        }
+        return 0;
+    }
+    
+    if (count_only) {
+        std::cout << find24Count(target, elems, options) << std::endl;
+        return 0;
+    }
+    
+    if (save_path) {
+        long count=find24(target, elems, options, save_path);
+        if (count < 0) {
+            std::cerr << "cannot write solutions to " << save_path
+            << std::endl;
+            return -1;
         }
+        std::cout << "Saved " << count << " solutions" << std::endl;
+        return 0;
+    }
+    
+    ExprWriter out(stdout);
+    if (find24(target, elems, options, out, format) == 0) {
+        std::cerr << "Oops, no solution found!" << std::endl;
     }
     
     return 0;
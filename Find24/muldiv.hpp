@@ -44,6 +44,14 @@ public:
         rank_ = calcRank(ExprType::MULDIV, mul_list_, div_list_);
     }
     
+    // straight from the member lists of another MulDiv (see checkpoint.hpp),
+    // which are in cmpExpr() order already
+    MulDiv(const ExprList& mul_list, const ExprList& div_list) :
+    mul_list_(mul_list), div_list_(div_list)
+    {
+        rank_ = calcRank(ExprType::MULDIV, mul_list_, div_list_);
+    }
+    
     int cmp(const Expr& other) const {
         const MulDiv* expr=dynamic_cast<const MulDiv*>(&other);
         int ret=compareExprList(mul_list_, expr->mul_list_);
@@ -51,26 +59,27 @@ public:
         return compareExprList(div_list_, expr->div_list_);
     }
     
-    std::string toString(bool embed) const {
+    void write(ExprWriter& out, bool embed) const {
         auto it=mul_list_.cbegin();
         assert(it != mul_list_.cend());
-        std::string ret=(*it)->toString(true);
+        (*it)->write(out, true);
         while (++it != mul_list_.cend()) {
-            ret+="*";
-            ret+=(*it)->toString(true);
+            out.put('*');
+            (*it)->write(out, true);
         }
         for (auto& expr : div_list_) {
-            ret+="/";
-            ret+=expr->toString(true);
+            out.put('/');
+            expr->write(out, true);
         }
-        
-        return ret;
     }
     
     ExprType getType() const { return ExprType::MULDIV; }
     
     Rank getRank() const { return rank_; }
     
+    const ExprList& getMulList() const { return mul_list_; }
+    const ExprList& getDivList() const { return div_list_; }
+    
     virtual ~MulDiv() {
         // all Expr* stored in the two lists are all borrowed references
         // hence no need to free.
@@ -0,0 +1,350 @@
+//
+//  opset.hpp
+//  Find24
+//
+
+#ifndef opset_hpp
+#define opset_hpp
+
+#include <stdint.h>
+#include <cmath>
+#include <type_traits>
+
+#include "expr.hpp"
+#include "addsub.hpp"
+#include "muldiv.hpp"
+#include "power.hpp"
+#include "searchlimits.hpp"
+
+enum class OpCode : uint8_t { PLUS, MINUS, MULTIPLE, DIVISION, POWER };
+
+// The operators of Find24 as compile-time policies. Each one has
+//   apply(left, right, limits, result): left op right, false if there is
+//     none (left op right is not a number, or breaks the limits on the way)
+//   solveLeft(sum, right, limits, fn): calls fn(x) for every x with
+//     sum = x op right
+//   solveRight(sum, left, limits, fn): same for sum = left op x
+// Between them they undo the operator, for the constraint layers (see
+// solveOp()) and for the joins of find24.cpp. Only sum = 0 can have more
+// solutions than they find, e.g. 0*x = 0 for every x.
+//   make(left, right): the canonical expression for left op right
+// The builders of find24.cpp are instantiated for an OpSet, so the loops
+// only contain the operators of the set, without a check for each.
+//
+// A commutative operator is applied to each pair of values once, the others
+// in both orders. When both operands of those have the same value, x op y
+// and y op x are the same thing, and only the one with the smaller left
+// operand (see cmpExpr()) is kept.
+struct PlusOp {
+    static const OpCode code=OpCode::PLUS;
+    static const unsigned bit=SearchLimits::PLUS;
+    static const bool commutative=true;
+    static const ExprType type=ExprType::ADDSUB;
+    static const bool inverse=false; // whether right is negated
+
+    template<typename R>
+    static bool apply(const R& left, const R& right, const SearchLimits&,
+                      R& result)
+    {
+        result=left + right;
+        return true;
+    }
+
+    template<typename R, typename Fn>
+    static void solveLeft(const R& sum, const R& right, const SearchLimits&,
+                          Fn& fn)
+    {
+        if (!(sum < right)) fn(sum - right);
+    }
+    
+    template<typename R, typename Fn>
+    static void solveRight(const R& sum, const R& left,
+                           const SearchLimits& limits, Fn& fn)
+    {
+        solveLeft(sum, left, limits, fn);
+    }
+
+    static Expr* make(const Expr* left, const Expr* right) {
+        return new AddSub(left, right, false);
+    }
+};
+
+// results are never negative
+struct MinusOp {
+    static const OpCode code=OpCode::MINUS;
+    static const unsigned bit=SearchLimits::MINUS;
+    static const bool commutative=false;
+    static const ExprType type=ExprType::ADDSUB;
+    static const bool inverse=true;
+
+    template<typename R>
+    static bool apply(const R& left, const R& right, const SearchLimits&,
+                      R& result)
+    {
+        if (left < right) return false;
+        result=left - right;
+        return true;
+    }
+
+    template<typename R, typename Fn>
+    static void solveLeft(const R& sum, const R& right, const SearchLimits&,
+                          Fn& fn)
+    {
+        fn(sum + right);
+    }
+    
+    template<typename R, typename Fn>
+    static void solveRight(const R& sum, const R& left, const SearchLimits&,
+                           Fn& fn)
+    {
+        if (!(left < sum)) fn(left - sum);
+    }
+
+    static Expr* make(const Expr* left, const Expr* right) {
+        return new AddSub(left, right, true);
+    }
+};
+
+struct MultipleOp {
+    static const OpCode code=OpCode::MULTIPLE;
+    static const unsigned bit=SearchLimits::MULTIPLE;
+    static const bool commutative=true;
+    static const ExprType type=ExprType::MULDIV;
+    static const bool inverse=false;
+
+    template<typename R>
+    static bool apply(const R& left, const R& right, const SearchLimits&,
+                      R& result)
+    {
+        result=left * right;
+        return true;
+    }
+
+    template<typename R, typename Fn>
+    static void solveLeft(const R& sum, const R& right, const SearchLimits&,
+                          Fn& fn)
+    {
+        if (!(right == R(0))) fn(sum / right);
+    }
+    
+    template<typename R, typename Fn>
+    static void solveRight(const R& sum, const R& left,
+                           const SearchLimits& limits, Fn& fn)
+    {
+        solveLeft(sum, left, limits, fn);
+    }
+
+    static Expr* make(const Expr* left, const Expr* right) {
+        return new MulDiv(left, right, false);
+    }
+};
+
+struct DivisionOp {
+    static const OpCode code=OpCode::DIVISION;
+    static const unsigned bit=SearchLimits::DIVISION;
+    static const bool commutative=false;
+    static const ExprType type=ExprType::MULDIV;
+    static const bool inverse=true;
+
+    template<typename R>
+    static bool apply(const R& left, const R& right, const SearchLimits&,
+                      R& result)
+    {
+        if (right == R(0)) return false;
+        result=left / right;
+        return true;
+    }
+
+    template<typename R, typename Fn>
+    static void solveLeft(const R& sum, const R& right, const SearchLimits&,
+                          Fn& fn)
+    {
+        fn(sum * right);
+    }
+    
+    template<typename R, typename Fn>
+    static void solveRight(const R& sum, const R& left, const SearchLimits&,
+                           Fn& fn)
+    {
+        if (!(sum == R(0))) fn(left / sum);
+    }
+
+    static Expr* make(const Expr* left, const Expr* right) {
+        return new MulDiv(left, right, true);
+    }
+};
+
+// base^exponent for whole exponents of at least 1. 0^x, 1^x and x^0 are
+// left out: they are 0 or 1 whatever x is, which the constraint layers
+// cannot undo. Powers are built one factor at a time and checked against
+// the limits (always set with POWER, see SearchLimits::effective()) after
+// each, so they stop long before they could overflow.
+struct PowerOp {
+    static const OpCode code=OpCode::POWER;
+    static const unsigned bit=SearchLimits::POWER;
+    static const bool commutative=false;
+    static const ExprType type=ExprType::POWER;
+    static const bool inverse=false;
+    
+    template<typename R>
+    static bool apply(const R& left, const R& right,
+                      const SearchLimits& limits, R& result)
+    {
+        if (!isBase(left) || right.divisor() != 1 || right.dividend() < 1) {
+            return false;
+        }
+        result=left;
+        for (auto e=right.dividend(); e>1; --e) {
+            result=result * left;
+            if (!limits.admits(result)) return false;
+        }
+        return true;
+    }
+    
+    // the whole root
+    template<typename R, typename Fn>
+    static void solveLeft(const R& sum, const R& right, const SearchLimits&,
+                          Fn& fn)
+    {
+        if (right.divisor() != 1 || right.dividend() < 1) return;
+        auto dividend=sum.dividend(), divisor=sum.divisor();
+        if (root(dividend, right.dividend()) &&
+            root(divisor, right.dividend())) {
+            fn(R(dividend, divisor));
+        }
+    }
+    
+    // the whole logarithm, found the way apply() would get there
+    template<typename R, typename Fn>
+    static void solveRight(const R& sum, const R& left,
+                           const SearchLimits& limits, Fn& fn)
+    {
+        if (!isBase(left)) return;
+        R power=left;
+        for (int e=1; ; ++e) {
+            if (power == sum) {
+                fn(R(e));
+                return;
+            }
+            power=power * left;
+            if (!limits.admits(power)) return;
+        }
+    }
+    
+    static Expr* make(const Expr* left, const Expr* right) {
+        return new Power(left, right);
+    }
+    
+private:
+    template<typename R>
+    static bool isBase(const R& value) {
+        return !(value == R(0)) && !(value == R(1));
+    }
+    
+    // replaces value with its whole e-th root, false if it has none; value
+    // is within the limits, so r^e never overflows on the way
+    template<typename Int>
+    static bool root(Int& value, Int e) {
+        if (value < 0) return false;
+        if (e == 1 || value < 2) return true;
+        if (e >= 64) return false; // 2^e > value
+        Int guess=(Int)(std::pow((double)value, 1.0/(double)e)+0.5);
+        for (Int r=(guess > 2 ? guess-1 : 2); r<=guess+1; ++r) {
+            Int power=1;
+            Int i=0;
+            for (; i<e && power<=value; ++i) power*=r;
+            if (i == e && power == value) {
+                value=r;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// calls fn(x) for every x with sum = x op other, and unless op is
+// commutative, for every x with sum = other op x
+template<typename Op, typename R, typename Fn>
+void solveOp(const R& sum, const R& other, const SearchLimits& limits,
+             Fn& fn)
+{
+    Op::solveLeft(sum, other, limits, fn);
+    if (!Op::commutative) Op::solveRight(sum, other, limits, fn);
+}
+
+// A set of operators known at compile time, ops is made of
+// SearchLimits::OpBits.
+template<unsigned ops>
+struct OpSet {
+    // calls fn.template apply<Op>() for each operator in the set, in the
+    // order of OpCode; the bits are only for AnyOpSet
+    template<typename Fn>
+    static void each(Fn& fn, unsigned) {
+        visit<PlusOp>(fn);
+        visit<MinusOp>(fn);
+        visit<MultipleOp>(fn);
+        visit<DivisionOp>(fn);
+        visit<PowerOp>(fn);
+    }
+    
+private:
+    template<typename Op, typename Fn>
+    static void visit(Fn& fn) {
+        visit<Op>(fn, std::integral_constant<bool, (ops & Op::bit) != 0>());
+    }
+    
+    template<typename Op, typename Fn>
+    static void visit(Fn& fn, std::true_type) { fn.template apply<Op>(); }
+    
+    template<typename Op, typename Fn>
+    static void visit(Fn&, std::false_type) { }
+};
+
+// The operators in bits, checked at run time: for the combinations that
+// are not worth a copy of the builders of their own.
+struct AnyOpSet {
+    template<typename Fn>
+    static void each(Fn& fn, unsigned bits) {
+        if (bits & PlusOp::bit) fn.template apply<PlusOp>();
+        if (bits & MinusOp::bit) fn.template apply<MinusOp>();
+        if (bits & MultipleOp::bit) fn.template apply<MultipleOp>();
+        if (bits & DivisionOp::bit) fn.template apply<DivisionOp>();
+        if (bits & PowerOp::bit) fn.template apply<PowerOp>();
+    }
+};
+
+// Calls fn.template run<Ops>() with the operator set for bits. The classic
+// game, the game with powers and + and * alone have loops of their own;
+// every instantiation is a full copy of the builders, so the rest share
+// AnyOpSet.
+template<typename Fn>
+void dispatchOpSet(unsigned bits, Fn& fn) {
+    switch (bits & (SearchLimits::ALL_OPS|SearchLimits::POWER)) {
+        case SearchLimits::ALL_OPS:
+            return fn.template run<OpSet<SearchLimits::ALL_OPS>>();
+        case SearchLimits::ALL_OPS|SearchLimits::POWER:
+            return fn.template run<OpSet<SearchLimits::ALL_OPS|
+                                         SearchLimits::POWER>>();
+        case SearchLimits::PLUS|SearchLimits::MULTIPLE:
+            return fn.template run<OpSet<SearchLimits::PLUS|
+                                         SearchLimits::MULTIPLE>>();
+        default:
+            return fn.template run<AnyOpSet>();
+    }
+}
+
+// the expression type (and which side is negated) of an operator at run time
+inline ExprType opType(OpCode op) {
+    switch (op) {
+        case OpCode::PLUS:
+        case OpCode::MINUS:
+            return ExprType::ADDSUB;
+        case OpCode::MULTIPLE:
+        case OpCode::DIVISION:
+            return ExprType::MULDIV;
+        default:
+            return ExprType::POWER;
+    }
+}
+
+#endif /* opset_hpp */
@@ -0,0 +1,83 @@
+//
+//  perfcounters.cpp
+//  Find24
+//
+
+#include "perfcounters.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+static int openCounter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size=sizeof(attr);
+    attr.type=type;
+    attr.config=config;
+    attr.exclude_kernel=1;
+    attr.exclude_hv=1;
+    attr.read_format=PERF_FORMAT_TOTAL_TIME_ENABLED |
+    PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+PerfCounters::PerfCounters() {
+    for (auto& fd : fds_) fd=-1;
+#ifdef __linux__
+    const uint64_t l1d_read_miss=PERF_COUNT_HW_CACHE_L1D |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const struct { uint32_t type; uint64_t config; } events[EVENTS]={
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, l1d_read_miss},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+    for (int e=0; e<EVENTS; ++e) {
+        fds_[e]=openCounter(events[e].type, events[e].config);
+        if (fds_[e] < 0 && error_.empty()) {
+            error_=std::string(name((Event)e))+": "+strerror(errno);
+        }
+    }
+#else
+    error_="perf_event_open is only available on Linux";
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+    for (auto fd : fds_) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+const char* PerfCounters::name(Event event) {
+    static const char* names[EVENTS]={"cycles", "instructions", "l1d-misses",
+        "llc-misses", "branch-misses"};
+    return names[event];
+}
+
+bool PerfCounters::anyValid() const {
+    for (auto fd : fds_) {
+        if (fd >= 0) return true;
+    }
+    return false;
+}
+
+PerfCounters::Sample PerfCounters::read() const {
+    Sample ret;
+    for (int e=0; e<EVENTS; ++e) {
+        uint64_t buf[3]; // value, time enabled, time running
+        if (fds_[e] < 0 || ::read(fds_[e], buf, sizeof(buf)) != sizeof(buf)) {
+            continue;
+        }
+        ret.values[e]=(buf[2] == 0 || buf[2] == buf[1]) ? buf[0] :
+        (uint64_t)((double)buf[0]*buf[1]/buf[2]);
+    }
+    return ret;
+}
@@ -0,0 +1,47 @@
+//
+//  perfcounters.hpp
+//  Find24
+//
+
+#ifndef perfcounters_hpp
+#define perfcounters_hpp
+
+#include <stdint.h>
+#include <string>
+
+// Hardware counters of the calling thread, read with perf_event_open(2).
+// Counters the kernel or the machine does not support (no PMU in a VM,
+// perf_event_paranoid, not Linux) are simply left out: isValid() tells which
+// ones are there, and error() why the others are not.
+class PerfCounters {
+public:
+    enum Event { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES,
+        EVENTS };
+    
+    struct Sample {
+        uint64_t values[EVENTS];
+        Sample() { for (auto& v : values) v=0; }
+    };
+    
+    PerfCounters();
+    ~PerfCounters();
+    
+    static const char* name(Event event);
+    
+    bool isValid(Event event) const { return fds_[event] >= 0; }
+    bool anyValid() const;
+    const std::string& error() const { return error_; }
+    
+    // the counts since the counters were opened, scaled up if the kernel had
+    // to multiplex them
+    Sample read() const;
+    
+private:
+    int fds_[EVENTS];
+    std::string error_;
+    
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+};
+
+#endif /* perfcounters_hpp */
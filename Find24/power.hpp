@@ -0,0 +1,66 @@
+//
+//  power.hpp
+//  Find24
+//
+
+#ifndef power_hpp
+#define power_hpp
+
+#include "expr.hpp"
+#include "rational.hpp"
+#include <string>
+
+// base^exponent. Unlike AddSub and MulDiv it has nothing to merge, so the
+// canonical form is just the two operands.
+class Power : public Expr {
+public:
+    Power(const Expr* base, const Expr* exponent) :
+    base_(base), exponent_(exponent)
+    {
+        RankBuilder rb(ExprType::POWER);
+        if (rb.addExprList({base}) && rb.addEOLMarker()) {
+            rb.addExprList({exponent});
+        }
+        rank_=rb.getRank();
+    }
+
+    int cmp(const Expr& other) const {
+        const Power* expr=dynamic_cast<const Power*>(&other);
+        int ret=cmpExpr(base_, expr->base_);
+        if (ret!=0) return ret;
+        return cmpExpr(exponent_, expr->exponent_);
+    }
+
+    // ^ binds tighter than the other operators, so only the operands may
+    // need parentheses, e.g. (2+3)^2 and 2^(3*4)
+    void write(ExprWriter& out, bool embed) const {
+        writeOperand(out, base_);
+        out.put('^');
+        writeOperand(out, exponent_);
+    }
+
+    ExprType getType() const { return ExprType::POWER; }
+
+    Rank getRank() const { return rank_; }
+
+    const Expr* getBase() const { return base_; }
+    const Expr* getExponent() const { return exponent_; }
+
+    virtual ~Power() {
+        // both operands are borrowed references
+    }
+
+private:
+    const Expr* base_;
+    const Expr* exponent_;
+    Rank rank_;
+
+    static void writeOperand(ExprWriter& out, const Expr* expr) {
+        bool literal=(expr->getType() == ExprType::LITERAL);
+        if (!literal) out.put('(');
+        expr->write(out, false);
+        if (!literal) out.put(')');
+    }
+};
+
+#endif /* power_hpp */
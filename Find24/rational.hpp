@@ -10,76 +10,123 @@
 #define rational_hpp
 
 #include <assert.h>
+#include <stdint.h>
 #include <string>
+#include <algorithm>
 
-class Rational {
+// The integer type used for the intermediate results of Rational<Int>. The
+// products of two Int must fit, except for __int128 which has nothing wider.
+template<typename Int> struct WideInt;
+template<> struct WideInt<int32_t> { typedef int64_t type; };
+template<> struct WideInt<int64_t> { typedef __int128 type; };
+template<> struct WideInt<__int128> { typedef __int128 type; };
+
+// std::to_string() does not take __int128
+template<typename Int>
+std::string intToString(Int value) {
+    if (value == 0) return "0";
+    bool negative = value < 0;
+    char buf[48];
+    char* p = buf + sizeof(buf);
+    while (value != 0) {
+        int digit = (int)(value % 10);
+        *--p = '0' + (negative ? -digit : digit);
+        value /= 10;
+    }
+    if (negative) *--p = '-';
+    return std::string(p, buf + sizeof(buf) - p);
+}
+
+// Exact fraction stored in Int. Every operation is carried out in the wider
+// integer type and narrowed after normalization, so it is exact as long as
+// the normalized dividend and divisor fit in Int (see chooseIntWidth()).
+template<typename Int>
+class BasicRational {
 public:
-    Rational(int64_t dividend, int64_t divisor=1) :
+    typedef typename WideInt<Int>::type Wide;
+    
+    BasicRational(Int dividend, Int divisor=1) :
     dividend_(dividend),
     divisor_(divisor)
     {
         assert(divisor != 0);
-        normalize();
+        if (divisor_ != 1) normalize(dividend, divisor);
     }
     
-    Rational operator + (const Rational& other) const
+    BasicRational operator + (const BasicRational& other) const
     {
-        return Rational(
-                        dividend_*other.divisor_+other.dividend_*divisor_,
-                        divisor_*other.divisor_);
+        return make((Wide)dividend_*other.divisor_+
+                    (Wide)other.dividend_*divisor_,
+                    (Wide)divisor_*other.divisor_);
     }
     
-    Rational operator - (const Rational& other) const
+    BasicRational operator - (const BasicRational& other) const
     {
-        return Rational(
-                        dividend_*other.divisor_-other.dividend_*divisor_,
-                        divisor_*other.divisor_);
+        return make((Wide)dividend_*other.divisor_-
+                    (Wide)other.dividend_*divisor_,
+                    (Wide)divisor_*other.divisor_);
     }
     
-    Rational operator * (const Rational& other) const
+    BasicRational operator * (const BasicRational& other) const
     {
-        return Rational(dividend_*other.dividend_, divisor_*other.divisor_);
+        return make((Wide)dividend_*other.dividend_,
+                    (Wide)divisor_*other.divisor_);
     }
     
-    Rational operator / (const Rational& other) const
+    BasicRational operator / (const BasicRational& other) const
     {
-        return Rational(dividend_*other.divisor_, divisor_*other.dividend_);
+        assert(other.dividend_ != 0);
+        return make((Wide)dividend_*other.divisor_,
+                    (Wide)divisor_*other.dividend_);
     }
     
-    bool operator == (const Rational& other) const
+    bool operator == (const BasicRational& other) const
     {
         return (dividend_==other.dividend_) && (divisor_==other.divisor_);
     }
     
-    bool operator < (const Rational& other) const
+    bool operator < (const BasicRational& other) const
     {
-        return dividend_*other.divisor_-other.dividend_*divisor_ < 0;
+        return (Wide)dividend_*other.divisor_ <
+        (Wide)other.dividend_*divisor_;
     }
     
-    int cmp(const Rational& other) const
+    int cmp(const BasicRational& other) const
     {
-        int64_t result = dividend_*other.divisor_-other.dividend_*divisor_;
-        return (result == 0) ? 0 : (result > 0) ? 1 : -1;
+        Wide left = (Wide)dividend_*other.divisor_;
+        Wide right = (Wide)other.dividend_*divisor_;
+        return (left == right) ? 0 : (left > right) ? 1 : -1;
     }
     
     std::string toString() const {
         if (dividend_==0) return "0";
-        std::string ret=std::to_string(dividend_);
+        std::string ret=intToString(dividend_);
         if (divisor_!=1) {
             ret+="/";
-            ret+=std::to_string(divisor_);
+            ret+=intToString(divisor_);
         }
         
         return ret;
     }
     
-    int64_t dividend() const { return dividend_; }
-    int64_t divisor() const { return divisor_; }
+    Int dividend() const { return dividend_; }
+    Int divisor() const { return divisor_; }
     
 private:
-    int64_t dividend_;
-    int64_t divisor_;
-    static int64_t gdc(int64_t left, int64_t right) {
+    Int dividend_;
+    Int divisor_;
+    
+    BasicRational() { }
+    
+    static BasicRational make(Wide dividend, Wide divisor) {
+        assert(divisor != 0);
+        BasicRational ret;
+        ret.normalize(dividend, divisor);
+        return ret;
+    }
+    
+    template<typename T>
+    static T gdc(T left, T right) {
         assert(right!=0);
         // making sure both parameters are non-negative
         if (left<0) left=-left;
@@ -91,23 +138,41 @@ private:
         if (left<right) std::swap(left, right);
         
         while ( (left%right) != 0) {
-            int64_t tmp=left%right;
+            T tmp=left%right;
             left=right;
             right=tmp;
         }
         return right;
     }
     
-    void normalize() {
-        int64_t x=gdc(dividend_, divisor_);
-        dividend_/=x;
-        divisor_/=x;
+    static bool fitsInt64(Wide x) {
+        return x >= INT64_MIN && x <= INT64_MAX;
+    }
+    
+    void normalize(Wide dividend, Wide divisor) {
+        // 128-bit division is a library call, avoid it when possible
+        if (sizeof(Wide) > 8 && fitsInt64(dividend) && fitsInt64(divisor)) {
+            reduce<int64_t>((int64_t)dividend, (int64_t)divisor);
+        } else {
+            reduce<Wide>(dividend, divisor);
+        }
+    }
+    
+    template<typename T>
+    void reduce(T dividend, T divisor) {
+        T x=gdc<T>(dividend, divisor);
+        dividend/=x;
+        divisor/=x;
         // make sure divisor is always positive
-        if (divisor_<0) {
-            divisor_=-divisor_;
-            dividend_=-dividend_;
+        if (divisor<0) {
+            divisor=-divisor;
+            dividend=-dividend;
         }
+        dividend_=(Int)dividend;
+        divisor_=(Int)divisor;
     }
 };
 
+typedef BasicRational<int64_t> Rational;
+
 #endif /* rational_hpp */
@@ -0,0 +1,68 @@
+//
+//  searchlimits.hpp
+//  Find24
+//
+
+#ifndef searchlimits_hpp
+#define searchlimits_hpp
+
+#include <stdint.h>
+
+// Extra rules some game variants put on the intermediate results. A value
+// that breaks them is dropped right where it is computed, so it never makes
+// it into the value tables. Intermediate results are never negative anyway.
+struct SearchLimits {
+    // ALL_OPS are the four operators of the classic game, POWER has to be
+    // asked for
+    enum OpBits { PLUS=1, MINUS=2, MULTIPLE=4, DIVISION=8, ALL_OPS=15,
+        POWER=16 };
+    
+    // POWER can reach any size, so with it values are kept within this
+    static const int64_t POWER_CAP=1LL<<30;
+    
+    bool integer_only;
+    int64_t max_dividend; // of any intermediate value, 0 for no limit
+    int64_t max_divisor; // 0 for no limit
+    unsigned ops; // the OpBits that may be used
+    
+    SearchLimits() : integer_only(false), max_dividend(0), max_divisor(0),
+    ops(ALL_OPS) { }
+    
+    bool allows(OpBits op) const { return (ops & op) != 0; }
+    
+    // the limits a search actually uses: with POWER, max_dividend and
+    // max_divisor are at most POWER_CAP
+    SearchLimits effective() const {
+        SearchLimits ret=*this;
+        if (allows(POWER)) {
+            if (!ret.max_dividend || ret.max_dividend > POWER_CAP) {
+                ret.max_dividend=POWER_CAP;
+            }
+            if (!ret.max_divisor || ret.max_divisor > POWER_CAP) {
+                ret.max_divisor=POWER_CAP;
+            }
+        }
+        return ret;
+    }
+    
+    // the limits for the value of the whole expression: the target is not
+    // an intermediate result, so it is admitted even above max_dividend
+    SearchLimits atRoot(int64_t target) const {
+        SearchLimits ret=*this;
+        if (target < 0) target=-target;
+        if (ret.max_dividend && ret.max_dividend < target) {
+            ret.max_dividend=target;
+        }
+        return ret;
+    }
+    
+    template<typename R> bool admits(const R& value) const {
+        if (integer_only && value.divisor() != 1) return false;
+        if (max_dividend && (value.dividend() > max_dividend ||
+                             value.dividend() < -max_dividend)) return false;
+        if (max_divisor && value.divisor() > max_divisor) return false;
+        return true;
+    }
+};
+
+#endif /* searchlimits_hpp */
@@ -10,7 +10,7 @@
 #define selectk_hpp
 
 template<typename Op>
-void selectK(int n, int k, Op op)
+void selectK(int n, int k, Op& op)
 {
     int selection[k];
     int index=0;
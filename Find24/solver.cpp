@@ -0,0 +1,174 @@
+//
+//  solver.cpp
+//  Find24
+//
+
+#include "solver.hpp"
+#include "find24_fixed.hpp"
+#include "beam24.hpp"
+
+// owns whichever search ran last, and with it all of its expressions
+class Solver::Result {
+public:
+    virtual ~Result() { }
+};
+
+template<typename T>
+class Solver::Holder : public Result {
+public:
+    Holder(int target, const std::vector<int>& elems) :
+    solver(target, elems) { }
+    T solver;
+};
+
+Solver::Solver(const SolverOptions& options) :
+options_(options), target_(0), exprset_(nullptr), count_(0),
+closest_(nullptr) { }
+
+Solver::~Solver() { }
+
+Find24Base::Status Solver::solve(int target, const int* elems, size_t count)
+{
+    const Find24Base::Clock::time_point start=Find24Base::Clock::now();
+    target_=target;
+    elems_.assign(elems, elems+count);
+    exprs_.clear();
+    exprset_=nullptr;
+    count_=0;
+    closest_=nullptr;
+    closest_value_.clear();
+    result_.reset();
+
+    Find24Base::Status status=Find24Base::Status::OK;
+    Find24Counters counters;
+    if (options_.engine == Engine::BEAM) {
+        solveBeam();
+        count_=exprs_.size();
+    } else {
+        switch (chooseIntWidth(target_, elems_, options_.limits)) {
+            case IntWidth::INT32:
+                solveWidth<int32_t>(status, counters);
+                break;
+            case IntWidth::INT64:
+                solveWidth<int64_t>(status, counters);
+                break;
+            case IntWidth::INT128:
+                solveWidth<__int128>(status, counters);
+                break;
+        }
+    }
+
+    if (options_.stats) {
+        SolveStats stats;
+        stats.engine=options_.engine;
+        stats.status=status;
+        stats.millis=std::chrono::duration<double, std::milli>(
+            Find24Base::Clock::now()-start).count();
+        stats.counters=counters;
+        options_.stats(stats);
+    }
+    return status;
+}
+
+// why a solve() with the given deadline should stop, OK if it should not
+Find24Base::Status
+Solver::stopStatus(Find24Base::Clock::time_point deadline) const
+{
+    if (options_.cancel && options_.cancel->load(std::memory_order_relaxed)) {
+        return Find24Base::Status::CANCELLED;
+    }
+    if (options_.timeout > Find24Base::Clock::duration::zero() &&
+        Find24Base::Clock::now() >= deadline) {
+        return Find24Base::Status::TIMEOUT;
+    }
+    return Find24Base::Status::OK;
+}
+
+// The fast path cannot be stopped on the way, so the cancel token and the
+// deadline are checked before and after it. Stopped, it leaves the
+// solutions out, as Find24 does.
+template<int N, typename Int>
+void Solver::solveFixed(Find24Base::Status& status, Find24Counters& counters)
+{
+    const Find24Base::Clock::time_point deadline=
+    Find24Base::Clock::now()+options_.timeout;
+    status=stopStatus(deadline);
+    if (status != Find24Base::Status::OK) return;
+
+    Holder<Find24Fixed<N, Int>>* holder=
+    new Holder<Find24Fixed<N, Int>>(target_, elems_);
+    result_.reset(holder);
+    Find24Fixed<N, Int>& helper=holder->solver;
+    helper.setLimits(options_.limits);
+    helper.run(options_.debug);
+
+    status=stopStatus(deadline);
+    counters=helper.getCounters();
+    if (status != Find24Base::Status::OK) return;
+    exprset_=helper.getExprSet();
+    if (exprset_) exprs_.assign(exprset_->begin(), exprset_->end());
+    count_=exprs_.size();
+}
+
+template<typename Int>
+void Solver::solveWidth(Find24Base::Status& status, Find24Counters& counters)
+{
+    // fast path for the common small games, which does not profile, rank,
+    // count without building, report progress or checkpoint (it takes
+    // microseconds, too little to stop on the way)
+    const bool topk=(options_.topk > 0 && !options_.count_only);
+    const bool fixed=!options_.profile && !topk && !options_.count_only &&
+    !options_.progress && options_.checkpoint.empty();
+    switch (fixed ? elems_.size() : 0) {
+        case 2: return solveFixed<2, Int>(status, counters);
+        case 3: return solveFixed<3, Int>(status, counters);
+        case 4: return solveFixed<4, Int>(status, counters);
+        case 5: return solveFixed<5, Int>(status, counters);
+        default: break;
+    }
+
+    Holder<BasicFind24<Int>>* holder=
+    new Holder<BasicFind24<Int>>(target_, elems_);
+    result_.reset(holder);
+    BasicFind24<Int>& helper=holder->solver;
+    helper.setWorkers(options_.workers);
+    helper.setLimits(options_.limits);
+    helper.setProfile(options_.profile);
+    if (topk) helper.setTopK(options_.topk);
+    helper.setCountOnly(options_.count_only);
+    if (options_.cancel) helper.setCancelToken(options_.cancel);
+    if (options_.progress) helper.setProgress(options_.progress);
+    if (!options_.checkpoint.empty()) {
+        helper.setCheckpoint(options_.checkpoint, options_.checkpoint_interval);
+    }
+    if (options_.timeout > Find24Base::Clock::duration::zero()) {
+        helper.setTimeout(options_.timeout);
+    }
+    status=helper.run(options_.debug);
+
+    counters=helper.getCounters();
+    exprset_=helper.getExprSet();
+    count_=helper.getCount();
+    if (topk) {
+        exprs_.assign(helper.getRanked().begin(), helper.getRanked().end());
+    } else if (exprset_) {
+        exprs_.assign(exprset_->begin(), exprset_->end());
+    }
+}
+
+void Solver::solveBeam()
+{
+    Holder<Beam24>* holder=new Holder<Beam24>(target_, elems_);
+    result_.reset(holder);
+    Beam24& helper=holder->solver;
+    helper.setSeed(options_.seed);
+    helper.setLimits(options_.limits);
+    if (options_.timeout > Find24Base::Clock::duration::zero()) {
+        helper.setTimeout(options_.timeout);
+    }
+    helper.run(options_.debug);
+
+    closest_=helper.getExpr();
+    if (closest_) closest_value_=helper.getValue().toString();
+    if (helper.isExact()) exprs_.push_back(closest_);
+}
@@ -0,0 +1,163 @@
+//
+//  solver.hpp
+//  Find24
+//
+
+#ifndef solver_hpp
+#define solver_hpp
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "find24.hpp"
+#include "exprwriter.hpp"
+#include "searchlimits.hpp"
+
+// EXACT finds every solution (or the top k), BEAM is the heuristic search
+// of beam24.hpp for inputs too large for that.
+enum class Engine { EXACT, BEAM };
+
+// handed to SolverOptions::stats after every solve()
+struct SolveStats {
+    Engine engine;
+    Find24Base::Status status;
+    double millis;
+    Find24Counters counters; // all zero for BEAM
+};
+
+struct SolverOptions {
+    Engine engine;
+    // > 1 shares the last layer of EXACT with that many threads (see
+    // Find24Base::setWorkers()), the one calling solve() among them
+    int workers;
+    SearchLimits limits;
+    // > 0 only keeps the k simplest solutions (see exprcost.hpp), EXACT only
+    int topk;
+    // 0 for no limit with EXACT, and for BEAM's default of 1 second (BEAM
+    // always runs until an exact solution or the timeout)
+    Find24Base::Clock::duration timeout;
+    // borrowed, must outlive solve(); EXACT only
+    const std::atomic<bool>* cancel;
+    uint64_t seed; // BEAM only
+    // print the counters to stdout, as the command line tool does
+    bool debug;
+    // with debug, also print the statistics of each phase (see
+    // Find24Base::setProfile()); EXACT only, and only the general solver
+    // keeps them
+    bool profile;
+    std::function<void(const SolveStats&)> stats;
+    // see Find24Base::setProgress(), EXACT only
+    Find24Base::ProgressCallback progress;
+    // only count the solutions, see Find24Base::setCountOnly() and
+    // Solver::count(); EXACT only, takes the place of topk
+    bool count_only;
+    // see Find24Base::setCheckpoint(), EXACT only, none if empty
+    std::string checkpoint;
+    Find24Base::Clock::duration checkpoint_interval;
+
+    SolverOptions() : engine(Engine::EXACT), workers(1), topk(0),
+    timeout(Find24Base::Clock::duration::zero()), cancel(nullptr), seed(1),
+    debug(false), profile(false), count_only(false),
+    checkpoint_interval(Find24Base::Clock::duration::zero()) { }
+};
+
+// The solutions of the last solve(), borrowed from the Solver: it is only
+// valid until the next solve() or until the Solver is gone. Nothing is
+// rendered until asked for.
+class SolutionView {
+public:
+    typedef const Expr* const* const_iterator;
+
+    SolutionView(const Expr* const* exprs, size_t size, int target) :
+    exprs_(exprs), size_(size), target_(target) { }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const Expr* operator[] (size_t i) const { return exprs_[i]; }
+    const_iterator begin() const { return exprs_; }
+    const_iterator end() const { return exprs_+size_; }
+    int getTarget() const { return target_; }
+
+    // just the expression, e.g. "8/(3-8/3)"
+    void write(size_t i, ExprWriter& out) const {
+        exprs_[i]->write(out, false);
+    }
+    std::string str(size_t i) const { return exprs_[i]->toString(false); }
+
+    // all of them, one per line as in writeExprSet()
+    void writeAll(ExprWriter& out, OutputFormat format) const {
+        for (auto expr : *this) writeExpr(out, expr, target_, format);
+    }
+
+private:
+    const Expr* const* exprs_;
+    size_t size_;
+    int target_;
+};
+
+// Reusable entry point to all the searches. It never changes the input, and
+// keeps the expressions of the last solve() for the SolutionView to point
+// into; each solve() builds its search from scratch. A Solver is not meant
+// to be shared between threads, but any number of them can run at the same
+// time, one per thread.
+class Solver {
+public:
+    explicit Solver(const SolverOptions& options=SolverOptions());
+    ~Solver();
+
+    const SolverOptions& getOptions() const { return options_; }
+    void setOptions(const SolverOptions& options) { options_ = options; }
+
+    Find24Base::Status solve(int target, const int* elems, size_t count);
+
+    Find24Base::Status solve(int target, const std::vector<int>& elems) {
+        return solve(target, elems.data(), elems.size());
+    }
+
+    // exact solutions only: in ExprSet order, or simplest first with topk
+    SolutionView solutions() const {
+        return SolutionView(exprs_.data(), exprs_.size(), target_);
+    }
+
+    // the number of exact solutions of the last solve(), the same as
+    // solutions().size() without count_only (and topk)
+    uint64_t count() const { return count_; }
+
+    // BEAM only: the closest expression found even if it is not exact,
+    // nullptr if none; its value is getClosestValue()
+    const Expr* getClosest() const { return closest_; }
+    std::string getClosestValue() const { return closest_value_; }
+
+    // all the solutions of the last EXACT solve() (even with topk), nullptr
+    // for BEAM or if there are none
+    const ExprSet* getExprSet() const { return exprset_; }
+
+private:
+    class Result;
+    template<typename T> class Holder;
+
+    SolverOptions options_;
+    std::vector<int> elems_;
+    std::vector<const Expr*> exprs_;
+    int target_;
+    std::unique_ptr<Result> result_;
+    const ExprSet* exprset_;
+    uint64_t count_;
+    const Expr* closest_;
+    std::string closest_value_;
+
+    template<typename Int> void solveWidth(Find24Base::Status& status,
+                                           Find24Counters& counters);
+    template<int N, typename Int> void solveFixed(Find24Base::Status& status,
+                                                  Find24Counters& counters);
+    Find24Base::Status stopStatus(
+        Find24Base::Clock::time_point deadline) const;
+    void solveBeam();
+
+    Solver(const Solver&);
+    Solver& operator=(const Solver&);
+};
+
+#endif /* solver_hpp */
@@ -0,0 +1,55 @@
+//
+//  solvertest.cpp
+//  Find24
+//
+
+// Checks of the Solver library API that the command line cannot reach.
+// Build and run with "make test"; prints the checks that fail, and exits
+// with 1 if there are any.
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include "solver.hpp"
+
+static int failures=0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+// a stop that has already fired ends every solve() without solutions,
+// whichever path it takes
+static void testStopped(const std::vector<int>& elems) {
+    std::atomic<bool> cancel(true);
+    SolverOptions options;
+    options.cancel=&cancel;
+    Solver cancelled(options);
+    check(cancelled.solve(24, elems) == Find24Base::Status::CANCELLED,
+          "a pre-set cancel token cancels");
+    check(cancelled.solutions().empty(), "a cancelled solve has no solutions");
+
+    options.cancel=nullptr;
+    options.timeout=std::chrono::nanoseconds(1);
+    Solver timed(options);
+    check(timed.solve(24, elems) == Find24Base::Status::TIMEOUT,
+          "a deadline that has passed times out");
+    check(timed.solutions().empty(), "a timed out solve has no solutions");
+
+    Solver free;
+    check(free.solve(24, elems) == Find24Base::Status::OK,
+          "a solve without a stop runs to the end");
+    check(!free.solutions().empty(), "a finished solve has its solutions");
+}
+
+int main() {
+    testStopped({4, 7, 8, 8}); // the fast path for small hands
+    testStopped({1, 2, 3, 4, 5, 6});
+    if (failures) return 1;
+    std::cout << "OK" << std::endl;
+    return 0;
+}